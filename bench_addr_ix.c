@@ -0,0 +1,109 @@
+/*
+ * Address index lookup benchmark.
+ *
+ * Opens a FIRST_FIT pool, makes a number of live allocations (2M by
+ * default, or argv[1]), and looks their addresses up in random order
+ * through the address index, the lookup behind mem_del_alloc_ptr. Three
+ * rounds of hits are followed by one round of misses, one byte into each
+ * allocation. Prints the average time per lookup for two ways of probing
+ * the same index:
+ *
+ *   keys  - the lookup as it is, comparing the keys in addr_ix_mem and
+ *           reading the node only on a match
+ *   nodes - the lookup as it was before the keys had an array of their
+ *           own, reading the node of every slot probed to compare its
+ *           address
+ *
+ * The index is internal, so mem_pool.c is built into this file.
+ * Build the bench_addr_ix target in a Release build to time it.
+ */
+
+#include "mem_pool.c"
+
+#include <time.h>
+
+#define BENCH_ROUNDS 3
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the probe loop of the node-only layout, over the slots in addr_ix
+static node_pt bench_find_through_nodes(pool_mgr_pt pool_mgr, const char *mem) {
+    unsigned mask = pool_mgr->addr_ix_capacity - 1;
+
+    for (unsigned i = _mem_addr_hash(mem, pool_mgr->addr_ix_capacity);
+         pool_mgr->addr_ix[i] != MEM_ADDR_IX_NIL; i = (i + 1) & mask)
+    {
+        node_pt node = _mem_node_at(pool_mgr, pool_mgr->addr_ix[i]);
+        if (node->alloc_record.mem == mem)
+            return node;
+    }
+
+    return NULL;
+}
+
+static void bench_run(const char *name, pool_mgr_pt pool_mgr, char **mem, unsigned n,
+                      node_pt (*find)(pool_mgr_pt, const char *)) {
+    volatile uintptr_t sink = 0;
+    unsigned found = 0;
+
+    double start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; ++round)
+        for (unsigned u = 0; u < n; ++u) {
+            node_pt node = find(pool_mgr, mem[u]);
+            found += (node != NULL);
+            sink += (uintptr_t) node;
+        }
+    for (unsigned u = 0; u < n; ++u) {
+        node_pt node = find(pool_mgr, mem[u] + 1);
+        found += (node != NULL);
+        sink += (uintptr_t) node;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%-5s: %u lookups (%u found): %.1f ns/lookup\n",
+           name, (BENCH_ROUNDS + 1) * n, found, elapsed * 1e9 / ((BENCH_ROUNDS + 1) * (double) n));
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n = (argc > 1) ? (unsigned) strtoul(argv[1], NULL, 10) : 2000000;
+
+    if (n == 0 || mem_init() != ALLOC_OK)
+        return 1;
+
+    // the sizes are a little over the small-object range, and varied
+    pool_pt pool = mem_pool_open((size_t) n * 300, FIRST_FIT);
+    char **mem = (char **) malloc(n * sizeof(char *));
+    if (pool == NULL || mem == NULL)
+        return 1;
+
+    for (unsigned u = 0; u < n; ++u) {
+        alloc_pt alloc = mem_new_alloc(pool, 257 + u % 7);
+        if (alloc == NULL)
+            return 1;
+        mem[u] = alloc->mem;
+    }
+
+    // shuffle, so the probes don't walk the pool in order
+    srand(1);
+    for (unsigned u = n - 1; u > 0; --u) {
+        unsigned v = (unsigned) rand() % (u + 1);
+        char *tmp = mem[u];
+        mem[u] = mem[v];
+        mem[v] = tmp;
+    }
+
+    printf("%u allocations\n", n);
+    bench_run("keys", (pool_mgr_pt) pool, mem, n, _mem_addr_ix_find);
+    bench_run("nodes", (pool_mgr_pt) pool, mem, n, bench_find_through_nodes);
+
+    free(mem);
+    mem_pool_reset(pool);
+    mem_pool_close(pool);
+    mem_free();
+
+    return 0;
+}
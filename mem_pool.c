@@ -2,10 +2,28 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for MAP_ANONYMOUS, MAP_HUGETLB and madvise()
+#endif
+
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h> // for memset()
 #include <assert.h>
 #include <stdio.h> // for perror()
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h> // for sysconf()
+#endif
+
+#if defined(MAP_ANONYMOUS)
+#define MEM_HAVE_MMAP 1
+#else
+#define MEM_HAVE_MMAP 0     // BACKING_MMAP and BACKING_HUGETLB fall back to malloc()
+#endif
+
 #include "mem_pool.h"
 
 /*************/
@@ -20,14 +38,69 @@ static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
 static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
 
+// the node heap grows by chunks that are never moved; chunk c holds
+// (MEM_NODE_HEAP_INIT_CAPACITY << c) nodes, so each one doubles the heap
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
 static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
-static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+#define                 MEM_NODE_HEAP_MAX_CHUNKS        22
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+// the address index is open-addressed, so its capacity is a power of two
+static const unsigned   MEM_ADDR_IX_INIT_CAPACITY       = 64;
+static const float      MEM_ADDR_IX_FILL_FACTOR         = 0.5;
+static const unsigned   MEM_ADDR_IX_EXPAND_FACTOR       = 2;
+
+static const unsigned   MEM_REGION_INIT_CAPACITY        = 4;
+static const size_t     MEM_HUGE_PAGE_SIZE              = 2 * 1024 * 1024;
+static const unsigned   MEM_REGION_EXPAND_FACTOR        = 2;  // size of each new region
+
+static const unsigned   MEM_SEG_MAX_CLASSES             = 64;
+static const size_t     MEM_SEG_DEFAULT_CLASSES[]       =
+        { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 65536 };
+
+// TLSF splits each power-of-two range of sizes into 2^MEM_TLSF_SL_LOG2
+// second-level classes; sizes below 2^MEM_TLSF_SL_LOG2 get a class each
+#define                 MEM_TLSF_SL_LOG2                4
+#define                 MEM_TLSF_SL_COUNT               (1u << MEM_TLSF_SL_LOG2)
+#define                 MEM_TLSF_FL_COUNT               64
+
+// small objects are packed into runs of MEM_SMALL_RUN_SIZE bytes at
+// addresses aligned to that size, in MEM_SMALL_GRANULE-byte granules
+#define                 MEM_SMALL_RUN_SIZE              4096
+#define                 MEM_SMALL_GRANULE               16
+#define                 MEM_SMALL_GRANULES              (MEM_SMALL_RUN_SIZE / MEM_SMALL_GRANULE)
+static const size_t     MEM_SMALL_OBJ_MAX               = 256;
+
+// BUDDY blocks are (MEM_BUDDY_MIN_BLOCK << order) bytes; a free block
+// holds its own free-list links, so the minimum has to fit two pointers
+static const size_t     MEM_BUDDY_MIN_BLOCK             = 16;
+static const unsigned   MEM_BUDDY_MAX_ORDERS            = 64;
+static const unsigned char MEM_BUDDY_START              = 0x40; // buddy_map flags
+static const unsigned char MEM_BUDDY_FREE               = 0x80;
+static const unsigned char MEM_BUDDY_ORDER_MASK         = 0x3F;
+
+// marks the absence of a node heap slot (end of the node list or a free list)
+#define                 MEM_NODE_NIL                    UINT_MAX
+
+// marks the absence of a gap index slot (empty subtree, end of free list)
+#define                 MEM_GAP_IX_NIL                  UINT_MAX
+
+// marks an empty slot of the address index
+#define                 MEM_ADDR_IX_NIL                 UINT_MAX
+
+// marks the absence of a STACK record (empty stack, no frame)
+#define                 MEM_STACK_NIL                   ((size_t) -1)
+
+// BOUNDARY_TAG blocks are multiples of MEM_TAG_ALIGN bytes, so the low
+// bits of a tag are free for the allocated flag; free blocks are kept in
+// one list per power-of-two class of their size
+static const size_t     MEM_TAG_ALIGN                   = 16;
+static const size_t     MEM_TAG_ALLOCATED               = 1;
+#define                 MEM_TAG_CLASSES                 64
+
 
 
 /*********************/
@@ -37,23 +110,136 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /*********************/
 typedef struct _node {
     alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
-    struct _node *next, *prev; // doubly-linked list for gap deletion
+    unsigned used : 1;
+    unsigned allocated : 1;
+    unsigned region_start : 1; // first segment of a region, never merged back
+    unsigned decommitted : 1;  // gap whose whole pages were given back to the OS
+    unsigned slot : 28;        // index of the node in the node heap
+    unsigned gap;              // gap_ix slot while the node is an indexed gap
+    uint32_t gen;              // bumped on deallocation, to reject stale handles
+    unsigned next, prev;       // slots of the neighbours in the doubly-linked
+                               //   list, MEM_NODE_NIL at either end
 } node_t, *node_pt;
 
+// the gap index lives in the gap_ix array; links are slot numbers so that
+// the array can be realloc-ed. BEST_FIT keeps the gaps in an AVL tree keyed
+// by (size, address), FIRST_FIT and NEXT_FIT in one keyed by address whose
+// entries cache the largest gap in each of their subtrees, SEGREGATED_FIT
+// and TLSF in one doubly-linked list per size class
 typedef struct _gap {
     size_t size;
     node_pt node;
+    unsigned left, right;   // subtrees, or prev/next in a size-class list;
+                            // left is the next free slot if unused
+    unsigned height;
+    size_t left_max;        // largest gap size in the left subtree, 0 if empty
+    size_t right_max;       // largest gap size in the right subtree
 } gap_t, *gap_pt;
 
+// links of a free BUDDY block, stored at the start of the block itself
+typedef struct _buddy_link {
+    char *next, *prev;
+} buddy_link_t, *buddy_link_pt;
+
+// header of a small-object run, at the start of the run itself; each
+// small object is an alloc_t record followed by its data, rounded up to
+// whole granules, and a set bit marks a granule in use
+typedef struct _small_run {
+    struct _pool_mgr *owner;
+    struct _small_run *next, *prev; // runs with free granules
+    unsigned node_ix;               // node_heap slot of the run's allocation
+    unsigned num_allocs;
+    unsigned free_granules;
+    unsigned listed;                // on the list of runs with free granules
+    uint64_t bitmap[MEM_SMALL_GRANULES / 64];
+} small_run_t, *small_run_pt;
+
+#define MEM_SMALL_HEADER_GRANULES ((sizeof(small_run_t) + MEM_SMALL_GRANULE - 1) / MEM_SMALL_GRANULE)
+
+// a STACK record, inline in front of its memory like an ARENA one; a
+// frame is a record with mem NULL whose size is the number of allocations
+// below it
+typedef struct _stack_record {
+    alloc_t alloc_record;
+    size_t prev;            // offset of the record below
+    size_t prev_frame;      // frame: offset of the frame below
+} stack_record_t, *stack_record_pt;
+
+// a BOUNDARY_TAG block header, inline in front of the block's memory;
+// prev_size is the boundary tag of the block before it, by which a freed
+// block finds that one's header, and tag is the size of this block with
+// MEM_TAG_ALLOCATED set while it is allocated
+typedef struct _tag_block {
+    size_t prev_size;
+    size_t tag;
+    alloc_t alloc_record;   // mem is NULL while the block is free
+} tag_block_t, *tag_block_pt;
+
+// links of a free BOUNDARY_TAG block, stored right after its header
+typedef struct _tag_link {
+    tag_block_pt next, prev;
+} tag_link_t, *tag_link_pt;
+
+// a free block has to hold its header and its links
+#define MEM_TAG_MIN_BLOCK (sizeof(tag_block_t) + sizeof(tag_link_t))
+
+// a backing region of the pool; the first one is pool.mem, growable
+// pools add more as they fill up
+typedef struct _region {
+    char *mem;
+    size_t size;
+    size_t mapped;          // length of the mapping, 0 if malloc-ed
+} region_t, *region_pt;
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    node_pt node_heap[MEM_NODE_HEAP_MAX_CHUNKS]; // chunk directory
+    unsigned node_chunks;
     unsigned total_nodes;
     unsigned used_nodes;
+    node_pt node_free;      // unused nodes, linked through node->next
+    region_pt regions;
+    unsigned num_regions;
+    unsigned region_capacity;
+    unsigned growable;      // add a region when no gap fits
+    pool_backing backing;   // where the regions' memory comes from
+    size_t mem_mapped;      // length of the mapping of pool.mem, 0 if malloc-ed
+    size_t decommit_threshold; // merged gaps from this size on are decommitted
+    size_t page_size;       // unit of decommitting
+    node_pt cursor;         // NEXT_FIT: where the next search starts
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned gap_ix_root;
+    unsigned gap_ix_free;   // head of the list of unused gap_ix slots
+    unsigned *addr_ix;      // node_heap slot of each allocation, hashed by
+                            //   its mem address (linear probing)
+    char **addr_ix_mem;     // the address of each addr_ix entry, NULL if
+                            //   empty, so probes never touch the nodes
+    unsigned addr_ix_capacity;
+    unsigned addr_ix_count;
+    size_t *seg_classes;    // SEGREGATED_FIT: lower bound of each class
+    unsigned *seg_heads;    // SEGREGATED_FIT: first gap_ix slot of each class
+    unsigned seg_num_classes;
+    uint64_t seg_map;       // SEGREGATED_FIT: bit set for each non-empty class
+    unsigned *tlsf_heads;   // TLSF: first gap_ix slot of each (fl, sl) class
+    uint64_t tlsf_fl_map;   // TLSF: bit set for each fl with a non-empty class
+    uint32_t tlsf_sl_map[MEM_TLSF_FL_COUNT]; // TLSF: non-empty classes per fl
+    unsigned char *buddy_map; // BUDDY: order and flags of the block starting
+                              //   at each MEM_BUDDY_MIN_BLOCK unit
+    size_t buddy_units;
+    char **buddy_free;      // BUDDY: head of the free list of each order
+    uint64_t buddy_free_map;// BUDDY: bit set for each non-empty order
+    size_t slab_obj_size;   // SLAB: size of each object (one node per object)
+    node_pt slab_free;      // SLAB: free nodes, linked through node->next
+    size_t arena_offset;    // ARENA and STACK: where the next record goes
+    size_t stack_top;       // STACK: offset of the top record
+    size_t stack_frame;     // STACK: offset of the top frame
+    size_t tag_end;         // BOUNDARY_TAG: end of the last block
+    tag_block_pt tag_free[MEM_TAG_CLASSES]; // BOUNDARY_TAG: free blocks of
+                                            //   each power-of-two class
+    uint64_t tag_free_map;  // BOUNDARY_TAG: bit set for each non-empty class
+    size_t small_obj_max;   // largest size served from small-object runs
+    small_run_pt small_runs;// runs with free granules
 } pool_mgr_t, *pool_mgr_pt;
 
 
@@ -76,6 +262,17 @@ static unsigned pool_store_capacity = 0;
 /********************************************/
 static alloc_status _mem_resize_pool_store();
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
+static alloc_status _mem_add_node_chunk(pool_mgr_pt pool_mgr);
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_slot_of(node_pt node);
+static void _mem_link_nodes(node_pt prev, node_pt next);
+static alloc_status _mem_add_region(pool_mgr_pt pool_mgr, size_t min_size);
+static region_pt _mem_region_of(pool_mgr_pt pool_mgr, const void *addr);
+static char *_mem_get_region_mem(pool_backing backing, size_t size, size_t *mapped);
+static size_t _mem_gap_pages(pool_mgr_pt pool_mgr, node_pt gap, char **start);
+static void _mem_mark_decommitted(pool_mgr_pt pool_mgr, node_pt gap, unsigned decommitted);
+static void _mem_decommit_gap(pool_mgr_pt pool_mgr, node_pt gap, char *from, char *to);
+static void _mem_put_region_mem(char *mem, size_t mapped);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
@@ -85,7 +282,124 @@ static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
                                 node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static node_pt _mem_find_best_gap(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status
+        _mem_init_seg_classes(pool_mgr_pt pool_mgr,
+                              const pool_opts_t *opts);
+static unsigned _mem_seg_class(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_seg_push(pool_mgr_pt pool_mgr, unsigned slot);
+static void _mem_seg_unlink(pool_mgr_pt pool_mgr, unsigned slot);
+static node_pt _mem_find_seg_gap(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_gap_list_push(pool_mgr_pt pool_mgr, unsigned *head, unsigned slot);
+static int _mem_gap_list_unlink(pool_mgr_pt pool_mgr, unsigned *head, unsigned slot);
+static unsigned _mem_ffs64(uint64_t word);
+static unsigned _mem_fls64(uint64_t word);
+static alloc_status _mem_init_tlsf(pool_mgr_pt pool_mgr);
+static void _mem_tlsf_mapping(size_t size, unsigned *fl, unsigned *sl);
+static void _mem_tlsf_push(pool_mgr_pt pool_mgr, unsigned slot);
+static void _mem_tlsf_unlink(pool_mgr_pt pool_mgr, unsigned slot);
+static node_pt _mem_find_tlsf_gap(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_node_of(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static node_pt _mem_find_next_gap(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_new_alloc_node(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_find_aligned_gap(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_status _mem_del_alloc_node(pool_mgr_pt pool_mgr, node_pt deletion);
+static alloc_status _mem_del_alloc_nodes(pool_mgr_pt pool_mgr, node_pt *nodes, unsigned n);
+static int _mem_node_cmp(const void *a, const void *b);
+static int _mem_alloc_cmp(const void *a, const void *b);
+static alloc_status _mem_reset_nodes(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_new_alloc_small(pool_mgr_pt pool_mgr, size_t size);
+static alloc_pt
+        _mem_new_alloc_record(pool_mgr_pt pool_mgr,
+                              size_t size,
+                              size_t alignment,
+                              int small);
+static alloc_status _mem_del_alloc_small(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static small_run_pt _mem_small_obj_run(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static small_run_pt _mem_small_run_of(pool_mgr_pt pool_mgr, node_pt node);
+static unsigned _mem_inspect_run(small_run_pt run, pool_segment_pt segments);
+static unsigned
+        _mem_bitmap_find(const uint64_t *map,
+                         unsigned num_bits,
+                         unsigned from,
+                         int set);
+static unsigned
+        _mem_bitmap_find_zeros(const uint64_t *map,
+                               unsigned num_bits,
+                               unsigned len);
+static void
+        _mem_bitmap_assign(uint64_t *map,
+                           unsigned start,
+                           unsigned len,
+                           int set);
+static void _mem_release_pool_mgr(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_addr_ix(pool_mgr_pt pool_mgr, unsigned count);
+static unsigned _mem_addr_hash(const char *mem, unsigned capacity);
+static void _mem_addr_ix_insert(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_addr_ix_remove(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_addr_ix_find(pool_mgr_pt pool_mgr, const char *mem);
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_chain_unused_nodes(pool_mgr_pt pool_mgr, node_pt chunk, unsigned first, unsigned count);
+static alloc_status _mem_init_buddy(pool_mgr_pt pool_mgr);
+static void _mem_buddy_carve(pool_mgr_pt pool_mgr);
+static void _mem_reset_buddy(pool_mgr_pt pool_mgr);
+static void _mem_buddy_push(pool_mgr_pt pool_mgr, size_t unit, unsigned order);
+static void _mem_buddy_unlink(pool_mgr_pt pool_mgr, size_t unit, unsigned order);
+static alloc_pt _mem_new_alloc_buddy(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_del_alloc_buddy(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status
+        _mem_init_slab(pool_mgr_pt pool_mgr,
+                       const pool_opts_t *opts);
+static alloc_pt _mem_new_alloc_slab(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_del_alloc_slab(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_reset_slab(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_bump(pool_mgr_pt pool_mgr, size_t header, size_t size, size_t alignment);
+static alloc_pt _mem_new_alloc_arena(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_pt _mem_new_alloc_stack(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_status _mem_del_alloc_stack(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void
+        _mem_inspect_stack(pool_mgr_pt pool_mgr,
+                           pool_segment_pt *segments,
+                           unsigned *num_segments);
+static void _mem_init_tags(pool_mgr_pt pool_mgr);
+static size_t _mem_tag_size(const tag_block_t *block);
+static tag_block_pt _mem_tag_next(pool_mgr_pt pool_mgr, tag_block_pt block);
+static void _mem_tag_push(pool_mgr_pt pool_mgr, tag_block_pt block);
+static void _mem_tag_unlink(pool_mgr_pt pool_mgr, tag_block_pt block);
+static tag_block_pt _mem_find_tag_block(pool_mgr_pt pool_mgr, size_t size);
+static tag_block_pt _mem_tag_block_of(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_pt _mem_new_alloc_tag(pool_mgr_pt pool_mgr, size_t size, size_t alignment);
+static alloc_status _mem_del_alloc_tag(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void
+        _mem_inspect_tags(pool_mgr_pt pool_mgr,
+                          pool_segment_pt *segments,
+                          unsigned *num_segments);
+static void
+        _mem_inspect_arena(pool_mgr_pt pool_mgr,
+                           pool_segment_pt *segments,
+                           unsigned *num_segments);
+static void
+        _mem_inspect_slab(pool_mgr_pt pool_mgr,
+                          pool_segment_pt *segments,
+                          unsigned *num_segments);
+static void
+        _mem_inspect_buddy(pool_mgr_pt pool_mgr,
+                           pool_segment_pt *segments,
+                           unsigned *num_segments);
+static int _mem_gap_cmp(pool_mgr_pt pool_mgr, const gap_t *a, const gap_t *b);
+static node_pt _mem_find_first_gap(pool_mgr_pt pool_mgr, unsigned root,
+                                   size_t size, const char *from);
+static unsigned _mem_gap_height(pool_mgr_pt pool_mgr, unsigned slot);
+static size_t _mem_gap_max(pool_mgr_pt pool_mgr, unsigned slot);
+static void _mem_gap_update(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_gap_rotate(pool_mgr_pt pool_mgr, unsigned slot, int left);
+static unsigned _mem_gap_balance(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_gap_insert(pool_mgr_pt pool_mgr, unsigned root, unsigned slot);
+static unsigned _mem_gap_remove(pool_mgr_pt pool_mgr, unsigned root,
+                                const gap_t *key, unsigned *removed);
+static unsigned _mem_gap_remove_min(pool_mgr_pt pool_mgr, unsigned root, unsigned *min);
 
 
 
@@ -124,11 +438,12 @@ alloc_status mem_free()
     // can free the pool store array
     // update static variables
 
-    if(pool_store != NULL)
-        mem_pool_close(&pool_store[0]->pool);
-    else
+    if(pool_store == NULL)
         return ALLOC_CALLED_AGAIN;
 
+    if(pool_store[0] != NULL)
+        mem_pool_close(&pool_store[0]->pool);
+
     pool_store_size = 0;
     pool_store_capacity = 0;
     free(pool_store);
@@ -142,25 +457,41 @@ alloc_status mem_free()
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy)
+{
+    return mem_pool_open_opts(size, policy, NULL);
+}
+
+pool_pt mem_pool_open_fixed(size_t obj_size, unsigned count)
+{
+    pool_opts_t opts = { .slab_obj_size = obj_size };
+
+    // guard the pool size against overflow
+    if (obj_size == 0 || count == 0 || obj_size > (size_t) -1 / count)
+        return NULL;
+
+    return mem_pool_open_opts(obj_size * count, SLAB, &opts);
+}
+
+pool_pt mem_pool_open_opts(size_t size, alloc_policy policy, const pool_opts_t *opts)
 {
     // make sure there the pool store is allocated
     if(pool_store == NULL)
         return NULL;
 
     // expand the pool store, if necessary
-    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR)
     if(_mem_resize_pool_store() != ALLOC_OK)
         return NULL;
 
     // allocate a new mem pool mgr
-    pool_mgr_pt pool_mgr = (pool_mgr_pt) malloc(sizeof(pool_mgr_t));
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
 
     // check success, on error return null
     if (pool_mgr == NULL)
         return NULL;
 
-    // allocate a new memory pool
-    pool_mgr->pool.mem = (char*) malloc(size);
+    // allocate a new memory pool from the backing store
+    pool_mgr->backing = (opts != NULL) ? opts->backing : BACKING_MALLOC;
+    pool_mgr->pool.mem = _mem_get_region_mem(pool_mgr->backing, size, &pool_mgr->mem_mapped);
 
     // check success, on error deallocate mgr and return null
     if (pool_mgr->pool.mem == NULL)
@@ -169,57 +500,170 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy)
         return NULL;
     }
 
-    // allocate a new node heap
-    pool_mgr->node_heap = (node_pt) calloc (MEM_NODE_HEAP_INIT_CAPACITY ,sizeof(node_t));
-    pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-
-    // check success, on error deallocate mgr/pool and return null
-    if (pool_mgr->node_heap == NULL)
+    // ARENA, STACK and BOUNDARY_TAG pools keep their metadata in the pool
+    // memory, and have neither a node heap, nor a gap index, nor an
+    // address index
+    if (policy != BOUNDARY_TAG && policy != ARENA && policy != STACK)
     {
-        free(pool_mgr);
-        return NULL;
+        // allocate a new node heap, with its first chunk on the free list
+        // check success, on error deallocate mgr/pool and return null
+        if (_mem_add_node_chunk(pool_mgr) != ALLOC_OK)
+        {
+            _mem_put_region_mem(pool_mgr->pool.mem, pool_mgr->mem_mapped);
+            free(pool_mgr);
+            return NULL;
+        }
+
+        // allocate a new gap index
+        pool_mgr->gap_ix = (gap_pt) calloc (MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+        pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+
+        // check success, on error deallocate mgr/pool/heap and return null
+        if (pool_mgr->gap_ix == NULL)
+        {
+            free(pool_mgr->node_heap[0]);
+            _mem_put_region_mem(pool_mgr->pool.mem, pool_mgr->mem_mapped);
+            free(pool_mgr);
+            return NULL;
+
+        }
+
+        // allocate a new address index, all slots empty
+        pool_mgr->addr_ix = (unsigned *) malloc(MEM_ADDR_IX_INIT_CAPACITY * sizeof(unsigned));
+        pool_mgr->addr_ix_mem = (char **) calloc(MEM_ADDR_IX_INIT_CAPACITY, sizeof(char *));
+        pool_mgr->addr_ix_capacity = MEM_ADDR_IX_INIT_CAPACITY;
+        pool_mgr->addr_ix_count = 0;
+
+        // check success, on error deallocate everything and return null
+        if (pool_mgr->addr_ix == NULL || pool_mgr->addr_ix_mem == NULL)
+        {
+            _mem_release_pool_mgr(pool_mgr);
+            return NULL;
+        }
+        for (unsigned u = 0; u < MEM_ADDR_IX_INIT_CAPACITY; ++u)
+            pool_mgr->addr_ix[u] = MEM_ADDR_IX_NIL;
     }
 
-    // allocate a new gap index
-    pool_mgr->gap_ix = (gap_pt) calloc (MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-    pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    // allocate the region list, the pool memory is the first region
+    pool_mgr->regions = (region_pt) calloc(MEM_REGION_INIT_CAPACITY, sizeof(region_t));
+    pool_mgr->region_capacity = MEM_REGION_INIT_CAPACITY;
 
-    // check success, on error deallocate mgr/pool/heap and return null
-    if (pool_mgr->gap_ix == NULL)
+    // check success, on error deallocate everything and return null
+    if (pool_mgr->regions == NULL)
     {
-        free(pool_mgr->node_heap);
-        free(&pool_mgr[0].pool);
-        free(pool_mgr);
+        _mem_release_pool_mgr(pool_mgr);
         return NULL;
-
     }
-    // assign all the pointers and update meta data:
-    //   initialize top node of node heap
-    pool_mgr->node_heap[0].next = NULL;
-    pool_mgr->node_heap[0].prev = NULL;
-    pool_mgr->node_heap[0].allocated = 0;
-    pool_mgr->node_heap[0].used = 0;
-    pool_mgr->node_heap[0].alloc_record.mem = pool_mgr->pool.mem;
-    pool_mgr->node_heap[0].alloc_record.size = size;
-
-    //   initialize top node of gap index
-    pool_mgr->gap_ix[0].size = size;
-    pool_mgr->gap_ix[0].node = pool_mgr->node_heap;
+    pool_mgr->regions[0].mem = pool_mgr->pool.mem;
+    pool_mgr->regions[0].size = size;
+    pool_mgr->regions[0].mapped = pool_mgr->mem_mapped;
+    pool_mgr->num_regions = 1;
 
+    // assign all the pointers and update meta data:
     //   initialize pool mgr
     pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.decommit_size = 0;
     pool_mgr->pool.num_allocs = 0;
     pool_mgr->pool.total_size = size;
-    pool_mgr->pool.num_gaps = 1;
+    pool_mgr->pool.num_gaps = 0;
     pool_mgr->pool.policy = policy;
-    pool_mgr->used_nodes = 1;
+    pool_mgr->used_nodes = 0;
 
-    //   link pool mgr to pool store
-    int i = 0;
-    while (pool_store[i] != NULL)
-        ++i;
-    pool_store[i] = pool_mgr;
-    pool_store_size = 1;
+    //   chain the unused gap index slots into the free list
+    for (unsigned u = 0; u < pool_mgr->gap_ix_capacity; ++u)
+        pool_mgr->gap_ix[u].left = (u + 1 < pool_mgr->gap_ix_capacity) ? u + 1 : MEM_GAP_IX_NIL;
+    pool_mgr->gap_ix_free = (pool_mgr->gap_ix_capacity != 0) ? 0 : MEM_GAP_IX_NIL;
+    pool_mgr->gap_ix_root = MEM_GAP_IX_NIL;
+
+    //   set up the small-object runs (not for BUDDY and SLAB)
+    alloc_status status = ALLOC_OK;
+    if (opts != NULL && opts->small_obj_max != 0)
+    {
+        if (policy == BUDDY || policy == SLAB || policy == ARENA || policy == STACK
+            || policy == BOUNDARY_TAG || opts->small_obj_max > MEM_SMALL_OBJ_MAX)
+            status = ALLOC_FAIL;
+        pool_mgr->small_obj_max = opts->small_obj_max;
+    }
+
+    //   growable pools (not BUDDY and SLAB, which are carved up front,
+    //   ARENA and STACK, which are a single offset, and BOUNDARY_TAG,
+    //   whose blocks are found by their sizes from the pool memory on)
+    if (opts != NULL && opts->growable)
+    {
+        if (policy == BUDDY || policy == SLAB || policy == ARENA || policy == STACK
+            || policy == BOUNDARY_TAG)
+            status = ALLOC_FAIL;
+        pool_mgr->growable = 1;
+    }
+
+    //   decommitting large gaps (mapped memory only, and not BUDDY,
+    //   SLAB and BOUNDARY_TAG, whose free blocks hold their links, or
+    //   ARENA and STACK, without gaps)
+    if (opts != NULL && opts->decommit_threshold != 0)
+    {
+        if (policy == BUDDY || policy == SLAB || policy == ARENA || policy == STACK
+            || policy == BOUNDARY_TAG || pool_mgr->backing == BACKING_MALLOC)
+            status = ALLOC_FAIL;
+        pool_mgr->decommit_threshold = opts->decommit_threshold;
+        pool_mgr->page_size = 4096;
+#if MEM_HAVE_MMAP
+        long page_size = sysconf(_SC_PAGESIZE);
+        if (page_size > 0)
+            pool_mgr->page_size = (size_t) page_size;
+#endif
+    }
+
+    //   set up the size classes (SEGREGATED_FIT and TLSF only)
+    if (status == ALLOC_OK && policy == SEGREGATED_FIT)
+        status = _mem_init_seg_classes(pool_mgr, opts);
+    else if (status == ALLOC_OK && policy == TLSF)
+        status = _mem_init_tlsf(pool_mgr);
+
+    //   carve the pool into free blocks (BUDDY) or objects (SLAB), leave
+    //   it as one stretch (ARENA and STACK) or one free block
+    //   (BOUNDARY_TAG), or initialize top node of node heap and index it
+    //   as the top gap
+    if (status == ALLOC_OK && policy == BUDDY)
+        status = _mem_init_buddy(pool_mgr);
+    else if (status == ALLOC_OK && policy == SLAB)
+        status = _mem_init_slab(pool_mgr, opts);
+    else if (status == ALLOC_OK && policy == BOUNDARY_TAG)
+    {
+        if (size < MEM_TAG_MIN_BLOCK)
+            status = ALLOC_FAIL;
+        else
+            _mem_init_tags(pool_mgr);
+    }
+    else if (status == ALLOC_OK && (policy == ARENA || policy == STACK))
+    {
+        pool_mgr->stack_top = pool_mgr->stack_frame = MEM_STACK_NIL;
+        pool_mgr->pool.num_gaps = 1;
+    }
+    else if (status == ALLOC_OK)
+    {
+        // the first pop from the free list is node_heap[0]
+        node_pt top = _mem_get_unused_node(pool_mgr);
+        top->next = MEM_NODE_NIL;
+        top->prev = MEM_NODE_NIL;
+        top->allocated = 0;
+        top->used = 1;
+        top->region_start = 1;
+        top->alloc_record.mem = pool_mgr->pool.mem;
+        top->alloc_record.size = size;
+        pool_mgr->used_nodes = 1;
+
+        status = _mem_add_to_gap_ix(pool_mgr, size, top);
+    }
+
+    // on error deallocate everything and return null
+    if (status != ALLOC_OK)
+    {
+        _mem_release_pool_mgr(pool_mgr);
+        return NULL;
+    }
+
+    //   link pool mgr to pool store, at the end
+    pool_store[pool_store_size++] = pool_mgr;
 
     // return the address of the mgr, cast to (pool_pt)
     return (pool_pt) pool_mgr;
@@ -234,143 +678,158 @@ alloc_status mem_pool_close(pool_pt pool)
     if (pool_mgr == NULL)
         return ALLOC_NOT_FREED;
 
-    // check if pool has only one gap
-    if (pool->num_gaps != 1)
-        return ALLOC_NOT_FREED;
-
     // check if it has zero allocations
+    // (then the node-list policies are down to a single gap, while BUDDY
+    // and SLAB pools keep one gap per free block or object)
     if (pool->num_allocs != 0)
         return ALLOC_NOT_FREED;
 
-    // free memory pool
-    free(pool);
-
-    // free node heap
-    free(pool_mgr->node_heap);
-
-    // free gap index
-    free(pool_mgr->gap_ix);
-
     // find mgr in pool store and set to null
-    int i = 0;
-    while (pool_store[i] != pool_mgr)
+    unsigned i = 0;
+    while (i < pool_store_size && pool_store[i] != pool_mgr)
         ++i;
+    if (i == pool_store_size)
+        return ALLOC_FAIL;
     pool_store[i] = NULL;
 
-    // free mgr
-    //free(pool_mgr);
+    // free memory pool, node heap, gap index and mgr
+    _mem_release_pool_mgr(pool_mgr);
 
     return ALLOC_OK;
 
 }
+alloc_status mem_pool_reset(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    alloc_status status = ALLOC_OK;
+
+    // drop all allocations at once, keeping the metadata arrays grown
+    if (pool_mgr->pool.policy == SLAB)
+        _mem_reset_slab(pool_mgr);
+    else if (pool_mgr->pool.policy == BUDDY)
+        _mem_reset_buddy(pool_mgr);
+    else if (pool_mgr->pool.policy == ARENA || pool_mgr->pool.policy == STACK)
+    {
+        pool_mgr->arena_offset = 0;
+        pool_mgr->stack_top = pool_mgr->stack_frame = MEM_STACK_NIL;
+        pool_mgr->pool.num_gaps = 1;
+    }
+    else if (pool_mgr->pool.policy == BOUNDARY_TAG)
+        _mem_init_tags(pool_mgr);
+    else
+        status = _mem_reset_nodes(pool_mgr);
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+
+    return status;
+}
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size)
 {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
 
-    // check if any gaps, return null if none
-    if (pool_mgr->gap_ix == NULL)
-        return NULL;
-
-    // expand heap node, if necessary, quit on error
-    if (pool_mgr->used_nodes / pool_mgr->total_nodes > MEM_NODE_HEAP_FILL_FACTOR)
-        if (_mem_resize_node_heap(pool_mgr) != ALLOC_OK)
-            return NULL;
+    return _mem_new_alloc_record(pool_mgr, size, 1, 1);
+}
+alloc_pt mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
 
-    // check used nodes fewer than total nodes, quit on error
-    if (pool_mgr->total_nodes < pool_mgr->used_nodes)
+    // the alignment has to be a power of two
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
         return NULL;
 
-    // get a node for allocation:
-    node_pt new_node;
-    int i = 0;
+    return _mem_new_alloc_record(pool_mgr, size, alignment, 1);
+}
+alloc_status mem_new_alloc_batch(pool_pt pool, const size_t *sizes, unsigned n, alloc_pt *out)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    if (n == 0)
+        return ALLOC_OK;
 
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if(pool_mgr->pool.policy == FIRST_FIT)
+    // SLAB and BUDDY can't carve, they allocate one by one (all or
+    // nothing), and so do ARENA and STACK, which are back to back anyway,
+    // and BOUNDARY_TAG, which has no nodes to carve
+    if (pool_mgr->pool.policy == SLAB || pool_mgr->pool.policy == BUDDY
+        || pool_mgr->pool.policy == ARENA || pool_mgr->pool.policy == STACK
+        || pool_mgr->pool.policy == BOUNDARY_TAG)
     {
-        node_pt heap = pool_mgr->node_heap;
+        arena_mark_t mark = mem_arena_mark(pool);
 
-        while((pool_mgr->node_heap[i].allocated != 0 && pool_mgr->node_heap[i].used !=0) || pool_mgr->node_heap[i].alloc_record.size < size)
+        for (unsigned u = 0; u < n; ++u)
         {
-            if(&pool_mgr->node_heap[i] == pool_mgr->gap_ix[0].node && pool_mgr->node_heap[i].alloc_record.size < size)
-                return NULL;
-            ++i;
+            out[u] = _mem_new_alloc_record(pool_mgr, sizes[u], 1, 0);
+            if (out[u] == NULL)
+            {
+                if (pool_mgr->pool.policy == ARENA)
+                    mem_arena_rewind(pool, mark);
+                else
+                    while (u > 0)
+                        mem_del_alloc(pool, out[--u]);
+                return ALLOC_FAIL;
+            }
         }
-
-        if(heap == NULL)
-            return NULL;
-
-        new_node = &pool_mgr->node_heap[i];
+        return ALLOC_OK;
     }
 
-        // if BEST_FIT, then find the first sufficient node in the gap index
-    else if(pool_mgr->pool.policy == BEST_FIT)
+    // the allocations are carved back to back, so one gap has to hold all
+    size_t total = 0;
+    for (unsigned u = 0; u < n; ++u)
     {
-        if (pool_mgr->pool.num_gaps > 0) {
-            while (i < pool_mgr->pool.num_gaps && pool_mgr->gap_ix[i+1].size >= size)
-                ++i;
-        }
-
-        else
-            return NULL;
-
-        new_node = pool_mgr->gap_ix[i].node;
+        if (sizes[u] == 0 || sizes[u] > (size_t) -1 - total)
+            return ALLOC_FAIL;
+        total += sizes[u];
     }
 
-    // check if node found
-    if(new_node == NULL)
-        return NULL;
-
-    // update metadata (num_allocs, alloc_size)
-    pool_mgr->pool.alloc_size += size;
-    ++pool_mgr->pool.num_allocs;
-
-    // calculate the size of the remaining gap, if any
-    size_t remainder = 0;
-    if (new_node->alloc_record.size - size > 0)
-        remainder = new_node->alloc_record.size - size;
-
-    // remove node from gap index
-    _mem_remove_from_gap_ix(pool_mgr, size, new_node);
+    // make room for all the nodes and address index entries up front,
+    // so that nothing fails once the gap is split
+    if (n > UINT_MAX - 2 - pool_mgr->used_nodes)
+        return ALLOC_FAIL;
+    while (pool_mgr->total_nodes < pool_mgr->used_nodes + n + 2)
+        if (_mem_add_node_chunk(pool_mgr) != ALLOC_OK)
+            return ALLOC_FAIL;
+    if (_mem_resize_addr_ix(pool_mgr, n) != ALLOC_OK)
+        return ALLOC_FAIL;
 
-    // convert gap_node to an allocation node of given size
-    new_node->allocated = 1;
-    new_node->used = 1;
-    new_node->alloc_record.size = size;
+    // one gap lookup and one gap index update for the whole batch
+    node_pt node = _mem_new_alloc_node(pool_mgr, total, 1);
+    if (node == NULL)
+        return ALLOC_FAIL;
 
-    // adjust node heap:
-    if (remainder != 0)
+    // split the allocation node into one node per size
+    node_pt after = _mem_node_at(pool_mgr, node->next);
+    char *mem = node->alloc_record.mem;
+    for (unsigned u = 0; u < n; ++u)
     {
-        //if remaining gap, need a new node
-        //find an unused one in the node heap
-        int i = 0;
-        while (pool_mgr->node_heap[i].used != 0)// && pool_mgr->node_heap[i].allocated != 0)
-            ++i;
-        node_pt new_gap = &pool_mgr->node_heap[i];
-
-        //initialize it to a gap node
-        new_gap->used = 1;
-        new_gap->allocated = 0;
-        new_gap->alloc_record.size = remainder;
-
-        //update metadata (used_nodes)
-        ++pool_mgr->used_nodes;
+        if (u != 0)
+        {
+            node_pt prev = node;
 
-        //update linked list (new node right after the node for allocation)
-        new_node->alloc_record.size = size;
-        if(new_node->next)
-            new_node->next->prev = new_gap;
-        new_gap->next = new_node->next;
-        new_node->next = new_gap;
-        new_gap->prev = new_node;
+            node = _mem_get_unused_node(pool_mgr);
+            node->used = 1;
+            node->allocated = 1;
+            _mem_link_nodes(prev, node);
+        }
+        node->alloc_record.mem = mem;
+        node->alloc_record.size = sizes[u];
+        mem += sizes[u];
 
-        //add to gap index
-        _mem_add_to_gap_ix(pool_mgr, remainder, new_gap);
+        _mem_addr_ix_insert(pool_mgr, node);
+        out[u] = (alloc_pt) node;
     }
+    _mem_link_nodes(node, after);
 
-    // return allocation record by casting the node to (alloc_pt)
-    return (alloc_pt)new_node;
+    // update metadata (used_nodes, num_allocs), alloc_size counts the total
+    pool_mgr->used_nodes += n - 1;
+    pool_mgr->pool.num_allocs += n - 1;
+
+    return ALLOC_OK;
 }
 
 alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc)
@@ -378,238 +837,2891 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc)
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
 
+    // ARENA allocations are only freed by a rewind
+    if (pool_mgr->pool.policy == ARENA)
+        return ALLOC_FAIL;
+
+    // STACK allocations are freed from the top
+    if (pool_mgr->pool.policy == STACK)
+        return _mem_del_alloc_stack(pool_mgr, alloc);
+
+    // BOUNDARY_TAG blocks coalesce through the tags around them
+    if (pool_mgr->pool.policy == BOUNDARY_TAG)
+        return _mem_del_alloc_tag(pool_mgr, alloc);
+
     // get node from alloc by casting the pointer to (node_pt)
-    node_pt node = (node_pt) alloc;
-    node_pt deletion = NULL;
+    // and make sure it is in the node heap, by address arithmetic
+    node_pt deletion = _mem_node_of(pool_mgr, alloc);
 
-    // find the node in the node heap
-    for (int i=0; i < pool_mgr->total_nodes; ++i)
-    {
-        if(node == &pool_mgr->node_heap[i])
-        {
-            deletion = &pool_mgr->node_heap[i];
-            break;
-        }
-    }
+    // a record inside the pool memory is a small object
+    if (deletion == NULL && pool_mgr->small_obj_max != 0)
+        return _mem_del_alloc_small(pool_mgr, alloc);
 
     // this is node-to-delete
-    // make sure it's found
-    if (deletion == NULL)
+    // make sure it's found and is a live allocation
+    if (deletion == NULL || !deletion->used || !deletion->allocated)
         return ALLOC_FAIL;
 
-    // update metadata (num_allocs, alloc_size)
-    deletion->allocated = 0;
-    --pool_mgr->pool.num_allocs;
-    pool_mgr->pool.alloc_size = pool_mgr->pool.alloc_size - deletion->alloc_record.size;
-
-    // if the next node in the list is also a gap, merge into node-to-delete
-    if (deletion->next != NULL && deletion->next->allocated == 0)
-    {
-        node_pt next = deletion->next;
-        if (_mem_remove_from_gap_ix(pool_mgr, 0, next) == ALLOC_FAIL)
-            return ALLOC_FAIL;
+    // SLAB nodes map one-to-one to objects
+    if (pool_mgr->pool.policy == SLAB)
+        return _mem_del_alloc_slab(pool_mgr, deletion);
 
-        deletion->alloc_record.size += next->alloc_record.size;
-        next->used = 0;
-        pool_mgr->used_nodes--;
+    // BUDDY coalesces by address arithmetic, not through the list
+    if (pool_mgr->pool.policy == BUDDY)
+        return _mem_del_alloc_buddy(pool_mgr, deletion);
 
-        if (next->next)
-        {
-            next->next->prev = deletion;
-            deletion->next = next->next;
-        }
+    // merge with neighbouring gaps through the list
+    _mem_addr_ix_remove(pool_mgr, deletion);
+    return _mem_del_alloc_node(pool_mgr, deletion);
+}
 
-        else
-            deletion->next = NULL;
+alloc_status mem_del_alloc_ptr(pool_pt pool, void *mem)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    char *addr = (char *) mem;
 
-        next->next = NULL;
-        next->prev = NULL;
-    }
+    // ARENA allocations are only freed by a rewind
+    if (addr == NULL || pool_mgr->pool.policy == ARENA)
+        return ALLOC_FAIL;
 
-    // this merged node-to-delete might need to be added to the gap index
-    // but one more thing to check...
-    // if the previous node in the list is also a gap, merge into previous!
-    if(deletion->prev != NULL && deletion->prev->allocated == 0)
+    // SLAB objects map to their nodes by offset into the pool
+    if (pool_mgr->pool.policy == SLAB)
     {
-        node_pt previous = deletion->prev;
-        if (_mem_remove_from_gap_ix(pool_mgr, 0, previous) == ALLOC_FAIL)
+        if (addr < pool_mgr->pool.mem || addr >= pool_mgr->pool.mem + pool_mgr->pool.total_size
+            || (size_t) (addr - pool_mgr->pool.mem) % pool_mgr->slab_obj_size != 0)
             return ALLOC_FAIL;
-        previous->alloc_record.size += deletion->alloc_record.size;
-        deletion->used = 0;
-        pool_mgr->used_nodes--;
-        if(deletion->next)
-        {
-            previous->next = deletion->next;
-            deletion->next->prev = previous;
-        }
-        else
-            previous->next = NULL;
 
-        deletion = previous;
+        size_t u = (size_t) (addr - pool_mgr->pool.mem) / pool_mgr->slab_obj_size;
+        return mem_del_alloc(pool, (alloc_pt) _mem_node_at(pool_mgr, (unsigned) u));
     }
 
-    // add the resulting node to the gap index
-    // check success
-    if (_mem_add_to_gap_ix(pool_mgr, deletion->alloc_record.size, deletion) != ALLOC_OK)
-        return ALLOC_FAIL;
-    else
-        return ALLOC_OK;
-}
-
-void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments)
-{
-    // get the mgr from the pool
-    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    // only the top STACK allocation can be freed, check its memory
+    if (pool_mgr->pool.policy == STACK)
+    {
+        if (pool_mgr->stack_top == MEM_STACK_NIL)
+            return ALLOC_FAIL;
 
-    // allocate the segments array with size == used_nodes
-    pool_segment_pt segmentArr = (pool_segment_pt) calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
-    assert(segmentArr);
-    node_pt current = pool_mgr->node_heap;
+        alloc_pt top = (alloc_pt) (pool_mgr->pool.mem + pool_mgr->stack_top);
+        return (top->mem == addr) ? _mem_del_alloc_stack(pool_mgr, top) : ALLOC_FAIL;
+    }
 
-    // loop through the node heap and the segments array
-    //    for each node, write the size and allocated in the segment
-    for (int i=0; i < pool_mgr->used_nodes; ++i)
+    // a BOUNDARY_TAG record is right in front of its memory
+    if (pool_mgr->pool.policy == BOUNDARY_TAG)
     {
-        segmentArr[i].size = current->alloc_record.size;
-        segmentArr[i].allocated = current->allocated;
-        if (current->next != NULL)
-            current = current->next;
+        if (addr < pool_mgr->pool.mem + sizeof(tag_block_t))
+            return ALLOC_FAIL;
+        return _mem_del_alloc_tag(pool_mgr, (alloc_pt) (addr - sizeof(alloc_t)));
     }
 
-    // "return" the values:
-    *segments = segmentArr;
-    *num_segments = pool_mgr->used_nodes;
-}
-
+    // node allocations are found through the address index
+    node_pt node = _mem_addr_ix_find(pool_mgr, addr);
+    if (node != NULL)
+        return mem_del_alloc(pool, (alloc_pt) node);
 
+    // a small object's record is right in front of its data
+    if (pool_mgr->small_obj_max != 0)
+        return _mem_del_alloc_small(pool_mgr, (alloc_pt) (addr - sizeof(alloc_t)));
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store()
+    return ALLOC_FAIL;
+}
+alloc_status mem_del_alloc_batch(pool_pt pool, alloc_pt *allocs, unsigned n)
 {
-    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-        pool_store = realloc(pool_store, sizeof(pool_store) * MEM_POOL_STORE_EXPAND_FACTOR);
-        pool_store_capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    alloc_status status = ALLOC_OK;
 
+    // ARENA allocations are only freed by a rewind, STACK ones from the top
+    if (pool_mgr->pool.policy == ARENA || pool_mgr->pool.policy == STACK)
+        return ALLOC_FAIL;
+    if (n == 0)
         return ALLOC_OK;
-    }
-    else {
+
+    // sort a copy by address, an allocation given twice would be freed twice
+    alloc_pt *sorted = (alloc_pt *) malloc((n ? n : 1) * sizeof(alloc_pt));
+    if (sorted == NULL)
         return ALLOC_FAIL;
-    }
-}
+    memcpy(sorted, allocs, n * sizeof(alloc_pt));
+    qsort(sorted, n, sizeof(alloc_pt), _mem_alloc_cmp);
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr)
-{
-    if (pool_mgr->used_nodes / pool_mgr->total_nodes > MEM_NODE_HEAP_FILL_FACTOR)
+    // make sure they are all live allocations before any is freed
+    for (unsigned u = 0; u < n; ++u)
     {
-        pool_mgr->node_heap = realloc(pool_mgr->node_heap, sizeof(pool_mgr->node_heap) * MEM_NODE_HEAP_EXPAND_FACTOR);
-        pool_mgr->total_nodes = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
+        int live;
+        if (u > 0 && sorted[u] == sorted[u - 1])
+            live = 0;
+        else if (pool_mgr->pool.policy == BOUNDARY_TAG)
+            live = _mem_tag_block_of(pool_mgr, sorted[u]) != NULL;
+        else
+        {
+            node_pt node = _mem_node_of(pool_mgr, sorted[u]);
+            if (node == NULL && pool_mgr->small_obj_max != 0)
+                live = _mem_small_obj_run(pool_mgr, sorted[u]) != NULL;
+            else
+                live = node != NULL && node->used && node->allocated;
+        }
 
-        return ALLOC_OK;
+        if (!live)
+        {
+            free(sorted);
+            return ALLOC_FAIL;
+        }
     }
 
-    else
+    // SLAB, BUDDY and BOUNDARY_TAG don't coalesce through the list,
+    // free one by one
+    if (pool_mgr->pool.policy == SLAB || pool_mgr->pool.policy == BUDDY
+        || pool_mgr->pool.policy == BOUNDARY_TAG)
     {
-        return ALLOC_FAIL;
+        for (unsigned u = 0; u < n; ++u)
+            if (mem_del_alloc(pool, sorted[u]) != ALLOC_OK)
+                status = ALLOC_FAIL;
+        free(sorted);
+        return status;
     }
-}
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr)
-{
-    if (pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity > MEM_GAP_IX_FILL_FACTOR)
+    // collect the nodes (small objects are not nodes)
+    node_pt *nodes = (node_pt *) sorted;
+    unsigned num_nodes = 0;
+    for (unsigned u = 0; u < n; ++u)
     {
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, sizeof(pool_mgr->gap_ix) * MEM_GAP_IX_EXPAND_FACTOR);
-        pool_mgr->gap_ix_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
-
-        return ALLOC_OK;
+        node_pt node = _mem_node_of(pool_mgr, allocs[u]);
+        if (node != NULL)
+            nodes[num_nodes++] = node;
     }
 
-    else
-    {
-        return ALLOC_FAIL;
+    // free the nodes in address order, merging each run once
+    status = _mem_del_alloc_nodes(pool_mgr, nodes, num_nodes);
+    free(sorted);
+    if (status != ALLOC_OK)
+        return status;
+
+    // the small objects go back to their runs one by one
+    for (unsigned u = 0; u < n; ++u)
+        if (_mem_node_of(pool_mgr, allocs[u]) == NULL
+            && _mem_del_alloc_small(pool_mgr, allocs[u]) != ALLOC_OK)
+            status = ALLOC_FAIL;
+
+    return status;
+}
+
+alloc_handle_t mem_new_alloc_handle(pool_pt pool, size_t size)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a handle names a node heap slot, so small objects get a node of their
+    // own (ARENA, STACK and BOUNDARY_TAG allocations have none)
+    if (pool_mgr->pool.policy == ARENA || pool_mgr->pool.policy == STACK
+        || pool_mgr->pool.policy == BOUNDARY_TAG)
+        return MEM_NULL_HANDLE;
+    alloc_pt alloc = _mem_new_alloc_record(pool_mgr, size, 1, 0);
+    if (alloc == NULL)
+        return MEM_NULL_HANDLE;
+
+    node_pt node = (node_pt) alloc;
+    return ((alloc_handle_t) node->gen << 32) | (alloc_handle_t) node->slot;
+}
+
+alloc_pt mem_resolve_handle(pool_pt pool, alloc_handle_t handle)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    uint32_t slot = (uint32_t) handle;
+    uint32_t gen = (uint32_t) (handle >> 32);
+
+    // the slot has to hold a live allocation of the same generation
+    if (slot >= pool_mgr->total_nodes)
+        return NULL;
+
+    node_pt node = _mem_node_at(pool_mgr, slot);
+    if (!node->used || !node->allocated || node->gen != gen)
+        return NULL;
+
+    return (alloc_pt) node;
+}
+
+alloc_status mem_del_alloc_handle(pool_pt pool, alloc_handle_t handle)
+{
+    alloc_pt alloc = mem_resolve_handle(pool, handle);
+
+    if (alloc == NULL)
+        return ALLOC_FAIL;
+
+    return mem_del_alloc(pool, alloc);
+}
+
+arena_mark_t mem_arena_mark(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    arena_mark_t mark;
+
+    mark.offset = pool_mgr->arena_offset;
+    mark.alloc_size = pool_mgr->pool.alloc_size;
+    mark.num_allocs = pool_mgr->pool.num_allocs;
+
+    return mark;
+}
+alloc_status mem_arena_rewind(pool_pt pool, arena_mark_t mark)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a mark can't be ahead of the arena (it was rewound past it)
+    if (pool_mgr->pool.policy != ARENA
+        || mark.offset > pool_mgr->arena_offset
+        || mark.num_allocs > pool_mgr->pool.num_allocs
+        || mark.alloc_size > pool_mgr->pool.alloc_size)
+        return ALLOC_FAIL;
+
+    // everything after the mark is freed at once
+    pool_mgr->arena_offset = mark.offset;
+    pool_mgr->pool.alloc_size = mark.alloc_size;
+    pool_mgr->pool.num_allocs = mark.num_allocs;
+    pool_mgr->pool.num_gaps = (mark.offset < pool_mgr->pool.total_size) ? 1 : 0;
+
+    return ALLOC_OK;
+}
+alloc_status mem_stack_push_frame(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    if (pool_mgr->pool.policy != STACK)
+        return ALLOC_FAIL;
+
+    // a frame is a record without memory on top of the stack
+    size_t offset = pool_mgr->arena_offset;
+    stack_record_pt frame = (stack_record_pt) _mem_bump(pool_mgr, sizeof(stack_record_t), 0, 1);
+    if (frame == NULL)
+        return ALLOC_FAIL;
+
+    frame->alloc_record.mem = NULL;
+    frame->alloc_record.size = pool_mgr->pool.num_allocs;
+    frame->prev = pool_mgr->stack_top;
+    frame->prev_frame = pool_mgr->stack_frame;
+    pool_mgr->stack_top = pool_mgr->stack_frame = offset;
+
+    return ALLOC_OK;
+}
+alloc_status mem_stack_pop_frame(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    if (pool_mgr->pool.policy != STACK || pool_mgr->stack_frame == MEM_STACK_NIL)
+        return ALLOC_FAIL;
+
+    // everything from the top frame up is freed at once
+    size_t offset = pool_mgr->stack_frame;
+    stack_record_pt frame = (stack_record_pt) (pool_mgr->pool.mem + offset);
+
+    pool_mgr->pool.alloc_size -= pool_mgr->arena_offset - offset;
+    pool_mgr->pool.num_allocs = (unsigned) frame->alloc_record.size;
+    pool_mgr->pool.num_gaps = 1;
+    pool_mgr->arena_offset = offset;
+    pool_mgr->stack_top = frame->prev;
+    pool_mgr->stack_frame = frame->prev_frame;
+
+    return ALLOC_OK;
+}
+void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // BUDDY blocks and SLAB objects are not on the node list
+    if (pool_mgr->pool.policy == BUDDY)
+    {
+        _mem_inspect_buddy(pool_mgr, segments, num_segments);
+        return;
+    }
+    if (pool_mgr->pool.policy == SLAB)
+    {
+        _mem_inspect_slab(pool_mgr, segments, num_segments);
+        return;
+    }
+    if (pool_mgr->pool.policy == ARENA)
+    {
+        _mem_inspect_arena(pool_mgr, segments, num_segments);
+        return;
+    }
+    if (pool_mgr->pool.policy == STACK)
+    {
+        _mem_inspect_stack(pool_mgr, segments, num_segments);
+        return;
+    }
+    if (pool_mgr->pool.policy == BOUNDARY_TAG)
+    {
+        _mem_inspect_tags(pool_mgr, segments, num_segments);
+        return;
+    }
+
+    // a small-object run is listed as its objects, so count them first
+    unsigned num = 0;
+    for (node_pt node = _mem_node_at(pool_mgr, 0); node != NULL; node = _mem_node_at(pool_mgr, node->next))
+    {
+        small_run_pt run = _mem_small_run_of(pool_mgr, node);
+        num += (run != NULL) ? _mem_inspect_run(run, NULL) : 1;
+    }
+
+    // allocate the segments array with size == num
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(num ? num : 1, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    // loop through the node list and the segments array
+    //    for each node, write the size and allocated in the segment
+    unsigned i = 0;
+    for (node_pt node = _mem_node_at(pool_mgr, 0); node != NULL; node = _mem_node_at(pool_mgr, node->next))
+    {
+        small_run_pt run = _mem_small_run_of(pool_mgr, node);
+        if (run != NULL)
+        {
+            i += _mem_inspect_run(run, &segmentArr[i]);
+            continue;
+        }
+
+        segmentArr[i].size = node->alloc_record.size;
+        segmentArr[i].allocated = node->allocated;
+        ++i;
+    }
+
+    // "return" the values:
+    *segments = segmentArr;
+    *num_segments = num;
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static alloc_status _mem_resize_pool_store()
+{
+    if (((float) (pool_store_size + 1) / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR)
+    {
+        unsigned new_capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_mgr_pt *new_store = realloc(pool_store, new_capacity * sizeof(pool_mgr_pt));
+
+        if (new_store == NULL)
+            return ALLOC_FAIL;
+
+        for (unsigned u = pool_store_capacity; u < new_capacity; ++u)
+            new_store[u] = NULL;
+
+        pool_store = new_store;
+        pool_store_capacity = new_capacity;
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr)
+{
+    // nodes never move, the heap just gets another chunk
+    if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR)
+        return _mem_add_node_chunk(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// allocate the next chunk of the node heap and put its nodes on the free list
+static alloc_status _mem_add_node_chunk(pool_mgr_pt pool_mgr)
+{
+    unsigned c = pool_mgr->node_chunks;
+    if (c == MEM_NODE_HEAP_MAX_CHUNKS)
+        return ALLOC_FAIL;
+
+    unsigned count = MEM_NODE_HEAP_INIT_CAPACITY << c;
+    node_pt chunk = (node_pt) calloc(count, sizeof(node_t));
+    if (chunk == NULL)
+        return ALLOC_FAIL;
+
+    pool_mgr->node_heap[c] = chunk;
+    pool_mgr->node_chunks = c + 1;
+    _mem_chain_unused_nodes(pool_mgr, chunk, pool_mgr->total_nodes, count);
+    pool_mgr->total_nodes += count;
+
+    return ALLOC_OK;
+}
+
+// chunk c starts at slot INIT * (2^c - 1), so it is found from the
+// highest bit of slot / INIT + 1; MEM_NODE_NIL is NULL
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    if (slot == MEM_NODE_NIL)
+        return NULL;
+
+    unsigned c = _mem_fls64(slot / MEM_NODE_HEAP_INIT_CAPACITY + 1);
+
+    return &pool_mgr->node_heap[c][slot - MEM_NODE_HEAP_INIT_CAPACITY * ((1u << c) - 1)];
+}
+
+static unsigned _mem_slot_of(node_pt node)
+{
+    return (node == NULL) ? MEM_NODE_NIL : node->slot;
+}
+
+// make next follow prev in the node list; either may be NULL (an end)
+static void _mem_link_nodes(node_pt prev, node_pt next)
+{
+    if (prev != NULL)
+        prev->next = _mem_slot_of(next);
+    if (next != NULL)
+        next->prev = _mem_slot_of(prev);
+}
+
+// add a region of at least min_size (and at least twice the last one)
+// whose single gap goes at the end of the node list
+static alloc_status _mem_add_region(pool_mgr_pt pool_mgr, size_t min_size)
+{
+    size_t size = pool_mgr->regions[pool_mgr->num_regions - 1].size;
+    size = (size > (size_t) -1 / MEM_REGION_EXPAND_FACTOR) ? (size_t) -1 : size * MEM_REGION_EXPAND_FACTOR;
+
+    // leave slack for the class rounding of SEGREGATED_FIT and TLSF lookups
+    if (min_size > (size_t) -1 - min_size / 8)
+        return ALLOC_FAIL;
+    if (size < min_size + min_size / 8)
+        size = min_size + min_size / 8;
+
+    // expand the region list, if necessary
+    if (pool_mgr->num_regions == pool_mgr->region_capacity)
+    {
+        unsigned new_capacity = pool_mgr->region_capacity * MEM_REGION_EXPAND_FACTOR;
+        region_pt new_regions = realloc(pool_mgr->regions, new_capacity * sizeof(region_t));
+
+        if (new_regions == NULL)
+            return ALLOC_FAIL;
+        pool_mgr->regions = new_regions;
+        pool_mgr->region_capacity = new_capacity;
+    }
+
+    // the new gap takes a node, and the allocation still needs two
+    if (pool_mgr->total_nodes < pool_mgr->used_nodes + 3
+        && _mem_add_node_chunk(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    size_t mapped;
+    char *mem = _mem_get_region_mem(pool_mgr->backing, size, &mapped);
+    if (mem == NULL)
+        return ALLOC_FAIL;
+
+    // the list is only walked when a region is added, which is rare
+    node_pt last = _mem_node_at(pool_mgr, 0);
+    while (last->next != MEM_NODE_NIL)
+        last = _mem_node_at(pool_mgr, last->next);
+
+    node_pt gap = _mem_get_unused_node(pool_mgr);
+    gap->used = 1;
+    gap->allocated = 0;
+    gap->region_start = 1;
+    gap->alloc_record.mem = mem;
+    gap->alloc_record.size = size;
+    _mem_link_nodes(last, gap);
+    _mem_link_nodes(gap, NULL);
+    ++pool_mgr->used_nodes;
+
+    if (_mem_add_to_gap_ix(pool_mgr, size, gap) != ALLOC_OK)
+    {
+        last->next = MEM_NODE_NIL;
+        _mem_put_unused_node(pool_mgr, gap);
+        _mem_put_region_mem(mem, mapped);
+        return ALLOC_FAIL;
+    }
+
+    pool_mgr->regions[pool_mgr->num_regions].mem = mem;
+    pool_mgr->regions[pool_mgr->num_regions].size = size;
+    pool_mgr->regions[pool_mgr->num_regions].mapped = mapped;
+    ++pool_mgr->num_regions;
+    pool_mgr->pool.total_size += size;
+
+    return ALLOC_OK;
+}
+
+// the region which holds addr, or NULL
+static region_pt _mem_region_of(pool_mgr_pt pool_mgr, const void *addr)
+{
+    uintptr_t a = (uintptr_t) addr;
+
+    for (unsigned r = 0; r < pool_mgr->num_regions; ++r)
+    {
+        uintptr_t base = (uintptr_t) pool_mgr->regions[r].mem;
+        if (a >= base && a < base + pool_mgr->regions[r].size)
+            return &pool_mgr->regions[r];
+    }
+
+    return NULL;
+}
+
+// memory for a region: malloc-ed, or mapped in whole huge pages at a
+// huge page boundary, explicitly (MAP_HUGETLB) or as transparent huge
+// pages, falling back from the former to the latter
+static char *_mem_get_region_mem(pool_backing backing, size_t size, size_t *mapped)
+{
+    *mapped = 0;
+
+#if MEM_HAVE_MMAP
+    if (backing != BACKING_MALLOC)
+    {
+        if (size == 0 || size > (size_t) -1 - 2 * MEM_HUGE_PAGE_SIZE)
+            return NULL;
+        size_t length = (size + MEM_HUGE_PAGE_SIZE - 1) & ~(MEM_HUGE_PAGE_SIZE - 1);
+        char *mem;
+
+#ifdef MAP_HUGETLB
+        if (backing == BACKING_HUGETLB)
+        {
+            mem = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mem != MAP_FAILED)
+            {
+                *mapped = length;
+                return mem;
+            }
+        }
+#endif
+
+        // map a huge page more than needed and trim it to the boundary
+        mem = mmap(NULL, length + MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return NULL;
+
+        size_t head = (MEM_HUGE_PAGE_SIZE - (uintptr_t) mem % MEM_HUGE_PAGE_SIZE) % MEM_HUGE_PAGE_SIZE;
+        if (head != 0)
+            munmap(mem, head);
+        munmap(mem + head + length, MEM_HUGE_PAGE_SIZE - head);
+        mem += head;
+
+#ifdef MADV_HUGEPAGE
+        // only advice, it fails where transparent huge pages are off
+        madvise(mem, length, MADV_HUGEPAGE);
+#endif
+
+        *mapped = length;
+        return mem;
+    }
+#else
+    (void) backing;
+#endif
+
+    return (char *) malloc(size);
+}
+
+static void _mem_put_region_mem(char *mem, size_t mapped)
+{
+#if MEM_HAVE_MMAP
+    if (mapped != 0)
+    {
+        munmap(mem, mapped);
+        return;
+    }
+#endif
+
+    free(mem);
+}
+static size_t _mem_gap_pages(pool_mgr_pt pool_mgr, node_pt gap, char **start)
+{
+    // the whole pages inside the gap, the only ones it can give back
+    uintptr_t lo = (uintptr_t) gap->alloc_record.mem;
+    uintptr_t hi = lo + gap->alloc_record.size;
+
+    lo = (lo + pool_mgr->page_size - 1) & ~(uintptr_t) (pool_mgr->page_size - 1);
+    hi &= ~(uintptr_t) (pool_mgr->page_size - 1);
+    *start = (char *) lo;
+
+    return (hi > lo) ? hi - lo : 0;
+}
+static void _mem_mark_decommitted(pool_mgr_pt pool_mgr, node_pt gap, unsigned decommitted)
+{
+    // a flagged gap has all of its whole pages decommitted, and counts
+    // them in decommit_size for as long as its bounds don't change
+    char *start;
+
+    if (gap->decommitted == decommitted)
+        return;
+    if (decommitted)
+        pool_mgr->pool.decommit_size += _mem_gap_pages(pool_mgr, gap, &start);
+    else
+        pool_mgr->pool.decommit_size -= _mem_gap_pages(pool_mgr, gap, &start);
+    gap->decommitted = decommitted;
+}
+static void _mem_decommit_gap(pool_mgr_pt pool_mgr, node_pt gap, char *from, char *to)
+{
+    // give back the whole pages of the gap between from and to (NULL for
+    // its bounds), the rest of them were given back before
+    char *start;
+    size_t length = _mem_gap_pages(pool_mgr, gap, &start);
+    char *end = start + length;
+
+    if (from != NULL && from > start)
+        start = from;
+    if (to != NULL && to < end)
+        end = to;
+
+#if MEM_HAVE_MMAP
+    // only mapped memory can be given back (and refaults zero-filled)
+    region_pt region = _mem_region_of(pool_mgr, gap->alloc_record.mem);
+    if (region == NULL || region->mapped == 0)
+        return;
+
+    // fails where the pages are not the system's (MAP_HUGETLB)
+    if (end > start && madvise(start, (size_t) (end - start), MADV_DONTNEED) != 0)
+        return;
+
+    _mem_mark_decommitted(pool_mgr, gap, 1);
+#else
+    (void) end;
+#endif
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr)
+{
+    if (((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR
+        || pool_mgr->gap_ix_free == MEM_GAP_IX_NIL)
+    {
+        unsigned new_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+        gap_pt new_ix = realloc(pool_mgr->gap_ix, new_capacity * sizeof(gap_t));
+
+        if (new_ix == NULL)
+            return ALLOC_FAIL;
+
+        // the tree links are slot numbers, so only the new slots need
+        // to be chained onto the free list
+        for (unsigned u = pool_mgr->gap_ix_capacity; u < new_capacity; ++u)
+        {
+            new_ix[u] = (gap_t) {0};
+            new_ix[u].left = (u + 1 < new_capacity) ? u + 1 : pool_mgr->gap_ix_free;
+        }
+        pool_mgr->gap_ix_free = pool_mgr->gap_ix_capacity;
+
+        pool_mgr->gap_ix = new_ix;
+        pool_mgr->gap_ix_capacity = new_capacity;
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_resize_addr_ix(pool_mgr_pt pool_mgr, unsigned count)
+{
+    // make room for count more entries
+    if (count > UINT_MAX / 4 - pool_mgr->addr_ix_count)
+        return ALLOC_FAIL;
+
+    if (((float) (pool_mgr->addr_ix_count + count) / pool_mgr->addr_ix_capacity) > MEM_ADDR_IX_FILL_FACTOR)
+    {
+        unsigned *old_ix = pool_mgr->addr_ix;
+        char **old_mem = pool_mgr->addr_ix_mem;
+        unsigned old_capacity = pool_mgr->addr_ix_capacity;
+        unsigned new_capacity = old_capacity * MEM_ADDR_IX_EXPAND_FACTOR;
+        while (((float) (pool_mgr->addr_ix_count + count) / new_capacity) > MEM_ADDR_IX_FILL_FACTOR)
+            new_capacity *= MEM_ADDR_IX_EXPAND_FACTOR;
+        unsigned *new_ix = (unsigned *) malloc(new_capacity * sizeof(unsigned));
+        char **new_mem = (char **) calloc(new_capacity, sizeof(char *));
+
+        if (new_ix == NULL || new_mem == NULL)
+        {
+            free(new_ix);
+            free(new_mem);
+            return ALLOC_FAIL;
+        }
+
+        // the slots depend on the capacity, so rehash every entry; the
+        // keys are at hand, so this does not touch the nodes either
+        unsigned mask = new_capacity - 1;
+        for (unsigned u = 0; u < new_capacity; ++u)
+            new_ix[u] = MEM_ADDR_IX_NIL;
+        for (unsigned u = 0; u < old_capacity; ++u)
+        {
+            if (old_mem[u] == NULL)
+                continue;
+
+            unsigned i = _mem_addr_hash(old_mem[u], new_capacity);
+            while (new_mem[i] != NULL)
+                i = (i + 1) & mask;
+            new_mem[i] = old_mem[u];
+            new_ix[i] = old_ix[u];
+        }
+
+        pool_mgr->addr_ix = new_ix;
+        pool_mgr->addr_ix_mem = new_mem;
+        pool_mgr->addr_ix_capacity = new_capacity;
+
+        free(old_ix);
+        free(old_mem);
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr, size_t size, node_pt node)
+{
+    // expand the gap index, if necessary (call the function)
+    if (_mem_resize_gap_ix(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // take a slot off the free list
+    unsigned slot = pool_mgr->gap_ix_free;
+    gap_pt gap = &pool_mgr->gap_ix[slot];
+    pool_mgr->gap_ix_free = gap->left;
+
+    gap->size = size;
+    gap->node = node;
+    gap->left = gap->right = MEM_GAP_IX_NIL;
+    gap->height = 1;
+    gap->left_max = gap->right_max = 0;
+    node->gap = slot;
+
+    // push it onto its class list, or insert it into the tree,
+    // rebalancing on the way up
+    if (pool_mgr->pool.policy == SEGREGATED_FIT)
+        _mem_seg_push(pool_mgr, slot);
+    else if (pool_mgr->pool.policy == TLSF)
+        _mem_tlsf_push(pool_mgr, slot);
+    else
+        pool_mgr->gap_ix_root = _mem_gap_insert(pool_mgr, pool_mgr->gap_ix_root, slot);
+
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps++;
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr, size_t size, node_pt node)
+{
+    unsigned removed = MEM_GAP_IX_NIL;
+
+    if (pool_mgr->pool.policy == SEGREGATED_FIT || pool_mgr->pool.policy == TLSF)
+    {
+        // the node knows its slot, unlink it from the class list
+        removed = node->gap;
+        if (removed >= pool_mgr->gap_ix_capacity || pool_mgr->gap_ix[removed].node != node)
+            return ALLOC_FAIL;
+        if (pool_mgr->pool.policy == SEGREGATED_FIT)
+            _mem_seg_unlink(pool_mgr, removed);
+        else
+            _mem_tlsf_unlink(pool_mgr, removed);
+    }
+    else
+    {
+        // the (size, address) key identifies the entry uniquely
+        gap_t key = { .size = size, .node = node };
+        pool_mgr->gap_ix_root = _mem_gap_remove(pool_mgr, pool_mgr->gap_ix_root, &key, &removed);
+    }
+
+    if (removed == MEM_GAP_IX_NIL)
+        return ALLOC_FAIL;
+
+    // return the slot to the free list
+    pool_mgr->gap_ix[removed] = (gap_t) {0};
+    pool_mgr->gap_ix[removed].left = pool_mgr->gap_ix_free;
+    pool_mgr->gap_ix_free = removed;
+
+    pool_mgr->pool.num_gaps--;
+
+    return ALLOC_OK;
+}
+
+// the lowest-addressed among the smallest gaps that fit, or NULL
+static node_pt _mem_find_best_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned best = MEM_GAP_IX_NIL;
+    unsigned slot = pool_mgr->gap_ix_root;
+
+    while (slot != MEM_GAP_IX_NIL)
+    {
+        if (pool_mgr->gap_ix[slot].size >= size)
+        {
+            best = slot;
+            slot = pool_mgr->gap_ix[slot].left;
+        }
+        else
+            slot = pool_mgr->gap_ix[slot].right;
+    }
+
+    return (best == MEM_GAP_IX_NIL) ? NULL : pool_mgr->gap_ix[best].node;
+}
+
+// the allocation part of mem_new_alloc; small objects only if small is set
+static alloc_pt
+        _mem_new_alloc_record(pool_mgr_pt pool_mgr,
+                              size_t size,
+                              size_t alignment,
+                              int small)
+{
+    // check if any gaps, return null if none (and the pool can't grow)
+    if ((pool_mgr->pool.num_gaps == 0 && !pool_mgr->growable) || size == 0)
+        return NULL;
+
+    // SLAB pools never split or grow, they pop a free object, which is
+    // aligned only if all of them are
+    if (pool_mgr->pool.policy == SLAB)
+    {
+        if ((uintptr_t) pool_mgr->pool.mem % alignment != 0
+            || pool_mgr->slab_obj_size % alignment != 0)
+            return NULL;
+        return _mem_new_alloc_slab(pool_mgr, size);
+    }
+
+    // BUDDY splits blocks instead of gap nodes; a block is aligned to its
+    // size relative to the pool memory
+    if (pool_mgr->pool.policy == BUDDY)
+    {
+        if ((uintptr_t) pool_mgr->pool.mem % alignment != 0)
+            return NULL;
+        return _mem_new_alloc_buddy(pool_mgr, (size < alignment) ? alignment : size);
+    }
+
+    // ARENA and STACK just move their offset on
+    if (pool_mgr->pool.policy == ARENA)
+        return _mem_new_alloc_arena(pool_mgr, size, alignment);
+    if (pool_mgr->pool.policy == STACK)
+        return _mem_new_alloc_stack(pool_mgr, size, alignment);
+
+    // BOUNDARY_TAG splits a free block found through its size classes
+    if (pool_mgr->pool.policy == BOUNDARY_TAG)
+        return _mem_new_alloc_tag(pool_mgr, size, alignment);
+
+    // small objects are packed into bitmap-managed runs, granule-aligned;
+    // when no run has room and the pool is too small or too fragmented
+    // for another, the object gets a node like any other allocation
+    if (small && size <= pool_mgr->small_obj_max && alignment <= MEM_SMALL_GRANULE)
+    {
+        alloc_pt alloc = _mem_new_alloc_small(pool_mgr, size);
+        if (alloc != NULL)
+            return alloc;
+    }
+
+    // make room in the address index before the pool changes
+    if (_mem_resize_addr_ix(pool_mgr, 1) != ALLOC_OK)
+        return NULL;
+
+    // split a gap node (the slack before an aligned address stays a gap)
+    // and index it by address
+    node_pt node = _mem_new_alloc_node(pool_mgr, size, alignment);
+    if (node == NULL)
+        return NULL;
+    _mem_addr_ix_insert(pool_mgr, node);
+
+    // return allocation record by casting the node to (alloc_pt)
+    return (alloc_pt) node;
+}
+
+// split a gap into an allocation of size at a multiple of alignment
+// (a power of two), the gap before it and the gap after it, if any
+static node_pt _mem_new_alloc_node(pool_mgr_pt pool_mgr, size_t size, size_t alignment)
+{
+    // check if any gaps, return null if none (and the pool can't grow)
+    if (pool_mgr->pool.num_gaps == 0 && !pool_mgr->growable)
+        return NULL;
+
+    // expand heap node, if necessary, quit on error
+    if (_mem_resize_node_heap(pool_mgr) != ALLOC_OK)
+        return NULL;
+
+    // check there are unused nodes for the gaps before and after
+    if (pool_mgr->total_nodes < pool_mgr->used_nodes + 2)
+        return NULL;
+
+    // get a gap for allocation: one that holds size at an aligned address
+    // as it is, or else one big enough for any alignment slack
+    if (size > (size_t) -1 - (alignment - 1))
+        return NULL;
+    node_pt new_node = (alignment > 1) ? _mem_find_aligned_gap(pool_mgr, size, alignment) : NULL;
+    if (new_node == NULL)
+        new_node = _mem_find_gap(pool_mgr, size + (alignment - 1));
+
+    // a growable pool takes another region when no gap fits
+    if (new_node == NULL && pool_mgr->growable
+        && _mem_add_region(pool_mgr, size + (alignment - 1)) == ALLOC_OK)
+        new_node = _mem_find_gap(pool_mgr, size + (alignment - 1));
+
+    // check if node found
+    if(new_node == NULL)
+        return NULL;
+
+    // remove node from gap index
+    _mem_remove_from_gap_ix(pool_mgr, new_node->alloc_record.size, new_node);
+
+    // the gaps split off a decommitted gap keep its pages decommitted
+    unsigned decommitted = new_node->decommitted;
+    _mem_mark_decommitted(pool_mgr, new_node, 0);
+
+    // leave the slack before the aligned address as a gap of its own
+    size_t lead = (alignment - (uintptr_t) new_node->alloc_record.mem % alignment) % alignment;
+    if (lead != 0)
+    {
+        node_pt lead_gap = new_node;
+
+        new_node = _mem_get_unused_node(pool_mgr);
+        new_node->used = 1;
+        new_node->alloc_record.mem = lead_gap->alloc_record.mem + lead;
+        new_node->alloc_record.size = lead_gap->alloc_record.size - lead;
+        ++pool_mgr->used_nodes;
+
+        _mem_link_nodes(new_node, _mem_node_at(pool_mgr, lead_gap->next));
+        _mem_link_nodes(lead_gap, new_node);
+
+        lead_gap->alloc_record.size = lead;
+        _mem_mark_decommitted(pool_mgr, lead_gap, decommitted);
+        if (_mem_add_to_gap_ix(pool_mgr, lead, lead_gap) != ALLOC_OK)
+            return NULL;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.alloc_size += size;
+    ++pool_mgr->pool.num_allocs;
+
+    // calculate the size of the remaining gap, if any
+    size_t remainder = new_node->alloc_record.size - size;
+
+    // convert gap_node to an allocation node of given size
+    new_node->allocated = 1;
+    new_node->used = 1;
+    new_node->alloc_record.size = size;
+
+    // adjust node heap:
+    if (remainder != 0)
+    {
+        //if remaining gap, need a new node
+        //find an unused one in the node heap
+        node_pt new_gap = _mem_get_unused_node(pool_mgr);
+
+        //initialize it to a gap node
+        new_gap->used = 1;
+        new_gap->allocated = 0;
+        new_gap->alloc_record.mem = new_node->alloc_record.mem + size;
+        new_gap->alloc_record.size = remainder;
+
+        //update metadata (used_nodes)
+        ++pool_mgr->used_nodes;
+
+        //update linked list (new node right after the node for allocation)
+        _mem_link_nodes(new_gap, _mem_node_at(pool_mgr, new_node->next));
+        _mem_link_nodes(new_node, new_gap);
+        _mem_mark_decommitted(pool_mgr, new_gap, decommitted);
+
+        //add to gap index
+        if (_mem_add_to_gap_ix(pool_mgr, remainder, new_gap) != ALLOC_OK)
+            return NULL;
+    }
+
+    // the next search resumes right after this allocation
+    pool_mgr->cursor = _mem_node_at(pool_mgr, new_node->next);
+
+    return new_node;
+}
+
+
+// a gap of at least size bytes, chosen by the pool's policy, or NULL
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    // if FIRST_FIT, then find the lowest-addressed sufficient gap
+    // in the gap index
+    if(pool_mgr->pool.policy == FIRST_FIT)
+    {
+        return _mem_find_first_gap(pool_mgr, pool_mgr->gap_ix_root, size, NULL);
+    }
+
+    // if BEST_FIT, then find the smallest sufficient gap in the gap index
+    else if(pool_mgr->pool.policy == BEST_FIT)
+    {
+        return _mem_find_best_gap(pool_mgr, size);
+    }
+
+    // if SEGREGATED_FIT, then take a gap off the size-class lists
+    else if(pool_mgr->pool.policy == SEGREGATED_FIT)
+    {
+        return _mem_find_seg_gap(pool_mgr, size);
+    }
+
+    // if TLSF, then take the first gap of the first class that surely fits
+    else if(pool_mgr->pool.policy == TLSF)
+    {
+        return _mem_find_tlsf_gap(pool_mgr, size);
+    }
+
+    // if NEXT_FIT, then find the first sufficient gap from the cursor on
+    else if(pool_mgr->pool.policy == NEXT_FIT)
+    {
+        return _mem_find_next_gap(pool_mgr, size);
+    }
+
+    return NULL;
+}
+
+// a gap of at least size bytes with room for them at a multiple of
+// alignment, or NULL; FIRST_FIT and NEXT_FIT go on in address order past
+// the gaps that have not, the other policies only check the gap they pick
+static node_pt _mem_find_aligned_gap(pool_mgr_pt pool_mgr, size_t size, size_t alignment)
+{
+    alloc_policy policy = pool_mgr->pool.policy;
+
+    if (policy != FIRST_FIT && policy != NEXT_FIT)
+    {
+        node_pt gap = _mem_find_gap(pool_mgr, size);
+        if (gap == NULL)
+            return NULL;
+        size_t lead = (alignment - (uintptr_t) gap->alloc_record.mem % alignment) % alignment;
+        return (gap->alloc_record.size - size >= lead) ? gap : NULL;
+    }
+
+    // NEXT_FIT starts at the cursor and wraps around to it
+    const char *start = (policy == NEXT_FIT && pool_mgr->cursor != NULL)
+                        ? pool_mgr->cursor->alloc_record.mem : NULL;
+    const char *from = start;
+    int wrapped = 0;
+
+    for (;;)
+    {
+        node_pt gap = _mem_find_first_gap(pool_mgr, pool_mgr->gap_ix_root, size, from);
+        if (gap != NULL && wrapped && gap->alloc_record.mem >= start)
+            return NULL;
+        if (gap == NULL)
+        {
+            if (start == NULL || wrapped)
+                return NULL;
+            wrapped = 1;
+            from = NULL;
+            continue;
+        }
+
+        size_t lead = (alignment - (uintptr_t) gap->alloc_record.mem % alignment) % alignment;
+        if (gap->alloc_record.size - size >= lead)
+            return gap;
+        from = gap->alloc_record.mem + 1;
+    }
+}
+
+// turn an allocation node into a gap, merging it with neighbouring gaps
+static alloc_status _mem_del_alloc_node(pool_mgr_pt pool_mgr, node_pt deletion)
+{
+    // update metadata (num_allocs, alloc_size)
+    deletion->allocated = 0;
+    ++deletion->gen;
+    --pool_mgr->pool.num_allocs;
+    pool_mgr->pool.alloc_size = pool_mgr->pool.alloc_size - deletion->alloc_record.size;
+
+    // the pages of decommitted neighbours need not be given back again
+    char *decommit_from = NULL, *decommit_to = NULL;
+    int decommitted = 0;
+
+    // if the next node in the list is also a gap, merge into node-to-delete
+    node_pt next = _mem_node_at(pool_mgr, deletion->next);
+    if (next != NULL && next->allocated == 0 && !next->region_start)
+    {
+        if (_mem_remove_from_gap_ix(pool_mgr, next->alloc_record.size, next) == ALLOC_FAIL)
+            return ALLOC_FAIL;
+
+        if (next->decommitted)
+        {
+            _mem_gap_pages(pool_mgr, next, &decommit_to);
+            decommitted = 1;
+        }
+        _mem_mark_decommitted(pool_mgr, next, 0);
+        deletion->alloc_record.size += next->alloc_record.size;
+
+        // the cursor moves to the start of the merged gap
+        if (pool_mgr->cursor == next)
+            pool_mgr->cursor = deletion;
+
+        _mem_link_nodes(deletion, _mem_node_at(pool_mgr, next->next));
+        _mem_put_unused_node(pool_mgr, next);
+    }
+
+    // this merged node-to-delete might need to be added to the gap index
+    // but one more thing to check...
+    // if the previous node in the list is also a gap, merge into previous!
+    node_pt previous = _mem_node_at(pool_mgr, deletion->prev);
+    if(previous != NULL && previous->allocated == 0 && !deletion->region_start)
+    {
+        if (_mem_remove_from_gap_ix(pool_mgr, previous->alloc_record.size, previous) == ALLOC_FAIL)
+            return ALLOC_FAIL;
+
+        if (previous->decommitted)
+        {
+            size_t length = _mem_gap_pages(pool_mgr, previous, &decommit_from);
+            decommit_from += length;
+            decommitted = 1;
+        }
+        _mem_mark_decommitted(pool_mgr, previous, 0);
+        previous->alloc_record.size += deletion->alloc_record.size;
+
+        if (pool_mgr->cursor == deletion)
+            pool_mgr->cursor = previous;
+        _mem_link_nodes(previous, _mem_node_at(pool_mgr, deletion->next));
+        _mem_put_unused_node(pool_mgr, deletion);
+        deletion = previous;
+    }
+
+    // give the pages of a large (or already partly decommitted) gap back
+    if (decommitted || (pool_mgr->decommit_threshold != 0
+                        && deletion->alloc_record.size >= pool_mgr->decommit_threshold))
+        _mem_decommit_gap(pool_mgr, deletion, decommit_from, decommit_to);
+
+    // add the resulting node to the gap index
+    // check success
+    if (_mem_add_to_gap_ix(pool_mgr, deletion->alloc_record.size, deletion) != ALLOC_OK)
+        return ALLOC_FAIL;
+    else
+        return ALLOC_OK;
+}
+static alloc_status _mem_del_alloc_nodes(pool_mgr_pt pool_mgr, node_pt *nodes, unsigned n)
+{
+    // sort by address, the order of the list
+    qsort(nodes, n, sizeof(node_pt), _mem_node_cmp);
+
+    // a node given twice would be freed twice
+    for (unsigned u = 1; u < n; ++u)
+        if (nodes[u] == nodes[u - 1])
+            return ALLOC_FAIL;
+
+    unsigned i = 0;
+    while (i < n)
+    {
+        // the merged gap starts at the gap right before the first node
+        node_pt start = nodes[i];
+        node_pt prev = _mem_node_at(pool_mgr, start->prev);
+        if (!start->region_start && prev != NULL && !prev->allocated)
+            start = prev;
+
+        // the pages of a decommitted gap at either end need not be given back again
+        char *decommit_from = NULL, *decommit_to = NULL;
+        int decommitted = 0;
+        size_t size = 0;
+
+        // sweep the run of freed nodes and gaps in between, up to the
+        // first allocation that stays (or the end of the region)
+        node_pt x = start;
+        for (;;)
+        {
+            node_pt next = _mem_node_at(pool_mgr, x->next);
+
+            if (x->allocated)
+            {
+                // update metadata (num_allocs, alloc_size)
+                x->allocated = 0;
+                ++x->gen;
+                --pool_mgr->pool.num_allocs;
+                pool_mgr->pool.alloc_size -= x->alloc_record.size;
+                _mem_addr_ix_remove(pool_mgr, x);
+                decommit_to = NULL;
+                ++i;
+            }
+            else
+            {
+                if (_mem_remove_from_gap_ix(pool_mgr, x->alloc_record.size, x) == ALLOC_FAIL)
+                    return ALLOC_FAIL;
+                decommit_to = NULL;
+                if (x->decommitted)
+                {
+                    size_t length = _mem_gap_pages(pool_mgr, x, &decommit_to);
+                    if (x == start)
+                        decommit_from = decommit_to + length;
+                    decommitted = 1;
+                }
+                _mem_mark_decommitted(pool_mgr, x, 0);
+            }
+
+            size += x->alloc_record.size;
+
+            // every node but the first goes back to the free list
+            if (x != start)
+            {
+                if (pool_mgr->cursor == x)
+                    pool_mgr->cursor = start;
+                _mem_put_unused_node(pool_mgr, x);
+            }
+
+            if (next == NULL || next->region_start
+                || (next->allocated && (i == n || nodes[i] != next)))
+            {
+                _mem_link_nodes(start, next);
+                break;
+            }
+            x = next;
+        }
+
+        start->alloc_record.size = size;
+
+        // give the pages of a large (or already partly decommitted) gap back
+        if (decommitted || (pool_mgr->decommit_threshold != 0
+                            && size >= pool_mgr->decommit_threshold))
+            _mem_decommit_gap(pool_mgr, start, decommit_from, decommit_to);
+
+        // the merged gap is indexed once
+        if (_mem_add_to_gap_ix(pool_mgr, size, start) != ALLOC_OK)
+            return ALLOC_FAIL;
+    }
+
+    return ALLOC_OK;
+}
+static int _mem_node_cmp(const void *a, const void *b)
+{
+    const char *mem_a = (*(const node_pt *) a)->alloc_record.mem;
+    const char *mem_b = (*(const node_pt *) b)->alloc_record.mem;
+
+    return (mem_a > mem_b) - (mem_a < mem_b);
+}
+
+static int _mem_alloc_cmp(const void *a, const void *b)
+{
+    uintptr_t alloc_a = (uintptr_t) *(const alloc_pt *) a;
+    uintptr_t alloc_b = (uintptr_t) *(const alloc_pt *) b;
+
+    return (alloc_a > alloc_b) - (alloc_a < alloc_b);
+}
+
+static alloc_status _mem_reset_nodes(pool_mgr_pt pool_mgr)
+{
+    node_pt top = _mem_node_at(pool_mgr, 0);
+
+    // every segment but the top one goes back to the free list, the
+    // allocations a generation older and out of the address index (so
+    // the cost is in the segments, not the index capacity), and the gap
+    // index slots with them
+    for (node_pt node = top; node != NULL; )
+    {
+        node_pt next = _mem_node_at(pool_mgr, node->next);
+
+        if (node->allocated)
+        {
+            ++node->gen;
+            _mem_addr_ix_remove(pool_mgr, node);
+        }
+        else
+        {
+            pool_mgr->gap_ix[node->gap].left = pool_mgr->gap_ix_free;
+            pool_mgr->gap_ix_free = node->gap;
+        }
+
+        if (node != top)
+            _mem_put_unused_node(pool_mgr, node);
+        node = next;
+    }
+
+    // empty the gap tree or class lists
+    pool_mgr->gap_ix_root = MEM_GAP_IX_NIL;
+    for (uint64_t map = pool_mgr->seg_map; map != 0; map &= map - 1)
+        pool_mgr->seg_heads[_mem_ffs64(map)] = MEM_GAP_IX_NIL;
+    pool_mgr->seg_map = 0;
+    for (uint64_t map = pool_mgr->tlsf_fl_map; map != 0; map &= map - 1)
+    {
+        unsigned fl = _mem_ffs64(map);
+        for (uint32_t sl_map = pool_mgr->tlsf_sl_map[fl]; sl_map != 0; sl_map &= sl_map - 1)
+            pool_mgr->tlsf_heads[fl * MEM_TLSF_SL_COUNT + _mem_ffs64(sl_map)] = MEM_GAP_IX_NIL;
+        pool_mgr->tlsf_sl_map[fl] = 0;
+    }
+    pool_mgr->tlsf_fl_map = 0;
+    pool_mgr->pool.num_gaps = 0;
+
+    pool_mgr->small_runs = NULL;
+    pool_mgr->cursor = NULL;
+    pool_mgr->pool.decommit_size = 0;   // counted again below
+
+    // the top node is the gap of the first region again
+    top->used = 1;
+    top->allocated = 0;
+    top->decommitted = 0;
+    top->region_start = 1;
+    top->alloc_record.mem = pool_mgr->regions[0].mem;
+    top->alloc_record.size = pool_mgr->regions[0].size;
+    top->prev = top->next = MEM_NODE_NIL;
+    if (_mem_add_to_gap_ix(pool_mgr, top->alloc_record.size, top) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // and every other region keeps a gap of its own
+    node_pt last = top;
+    for (unsigned r = 1; r < pool_mgr->num_regions; ++r)
+    {
+        node_pt gap = _mem_get_unused_node(pool_mgr);
+        gap->used = 1;
+        gap->allocated = 0;
+        gap->region_start = 1;
+        gap->alloc_record.mem = pool_mgr->regions[r].mem;
+        gap->alloc_record.size = pool_mgr->regions[r].size;
+        _mem_link_nodes(last, gap);
+        _mem_link_nodes(gap, NULL);
+        last = gap;
+        ++pool_mgr->used_nodes;
+
+        if (_mem_add_to_gap_ix(pool_mgr, gap->alloc_record.size, gap) != ALLOC_OK)
+            return ALLOC_FAIL;
+    }
+
+    // each region is a freed gap now, so its pages go back over the
+    // threshold (a region with decommitted pages is always over it)
+    if (pool_mgr->decommit_threshold != 0)
+        for (node_pt gap = top; gap != NULL; gap = _mem_node_at(pool_mgr, gap->next))
+            if (gap->alloc_record.size >= pool_mgr->decommit_threshold)
+                _mem_decommit_gap(pool_mgr, gap, NULL, NULL);
+
+    return ALLOC_OK;
+}
+
+// a small object: the first run with room for its record and data, or a
+// new run carved out of the pool as an aligned allocation
+static alloc_pt _mem_new_alloc_small(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned granules = (unsigned) ((sizeof(alloc_t) + size + MEM_SMALL_GRANULE - 1) / MEM_SMALL_GRANULE);
+    small_run_pt run;
+    unsigned start = UINT_MAX;
+
+    for (run = pool_mgr->small_runs; run != NULL; run = run->next)
+    {
+        start = _mem_bitmap_find_zeros(run->bitmap, MEM_SMALL_GRANULES, granules);
+        if (start != UINT_MAX)
+            break;
+    }
+
+    if (run == NULL)
+    {
+        node_pt node = _mem_new_alloc_node(pool_mgr, MEM_SMALL_RUN_SIZE, MEM_SMALL_RUN_SIZE);
+        if (node == NULL)
+            return NULL;
+
+        // the header takes up the first granules
+        run = (small_run_pt) node->alloc_record.mem;
+        *run = (small_run_t) {0};
+        run->owner = pool_mgr;
+        run->node_ix = node->slot;
+        run->free_granules = MEM_SMALL_GRANULES - MEM_SMALL_HEADER_GRANULES;
+        _mem_bitmap_assign(run->bitmap, 0, MEM_SMALL_HEADER_GRANULES, 1);
+
+        run->next = pool_mgr->small_runs;
+        if (run->next)
+            run->next->prev = run;
+        pool_mgr->small_runs = run;
+        run->listed = 1;
+
+        // the run is bookkeeping, only its objects count as allocations
+        --pool_mgr->pool.num_allocs;
+        pool_mgr->pool.alloc_size -= MEM_SMALL_RUN_SIZE;
+
+        start = MEM_SMALL_HEADER_GRANULES;
+    }
+
+    _mem_bitmap_assign(run->bitmap, start, granules, 1);
+    ++run->num_allocs;
+    run->free_granules -= granules;
+
+    // a run without room for the smallest object leaves the list
+    if (run->free_granules < 2)
+    {
+        if (run->prev)
+            run->prev->next = run->next;
+        else
+            pool_mgr->small_runs = run->next;
+        if (run->next)
+            run->next->prev = run->prev;
+        run->listed = 0;
+    }
+
+    alloc_pt record = (alloc_pt) ((char *) run + start * MEM_SMALL_GRANULE);
+    record->size = size;
+    record->mem = (char *) record + sizeof(alloc_t);
+
+    // update metadata (num_allocs, alloc_size), alloc_size counts the granules
+    ++pool_mgr->pool.num_allocs;
+    pool_mgr->pool.alloc_size += granules * MEM_SMALL_GRANULE;
+
+    return record;
+}
+
+// the run of a live small object, or NULL
+static small_run_pt _mem_small_obj_run(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    uintptr_t addr = (uintptr_t) alloc;
+    region_pt region = _mem_region_of(pool_mgr, alloc);
+
+    // the run is found by rounding the record's address down
+    if (region == NULL || addr % MEM_SMALL_GRANULE != 0)
+        return NULL;
+    uintptr_t mem = (uintptr_t) region->mem;
+
+    small_run_pt run = (small_run_pt) (addr & ~((uintptr_t) MEM_SMALL_RUN_SIZE - 1));
+    unsigned start = (unsigned) ((addr - (uintptr_t) run) / MEM_SMALL_GRANULE);
+
+    if ((uintptr_t) run < mem || run->owner != pool_mgr || start < MEM_SMALL_HEADER_GRANULES
+        || run->node_ix >= pool_mgr->total_nodes
+        || _mem_node_at(pool_mgr, run->node_ix)->alloc_record.mem != (char *) run
+        || !_mem_node_at(pool_mgr, run->node_ix)->allocated
+        || !(run->bitmap[start / 64] & ((uint64_t) 1 << (start % 64)))
+        || alloc->mem != (char *) alloc + sizeof(alloc_t) || alloc->size > pool_mgr->small_obj_max)
+        return NULL;
+
+    return run;
+}
+
+static alloc_status _mem_del_alloc_small(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    small_run_pt run = _mem_small_obj_run(pool_mgr, alloc);
+    if (run == NULL)
+        return ALLOC_FAIL;
+    unsigned start = (unsigned) (((uintptr_t) alloc - (uintptr_t) run) / MEM_SMALL_GRANULE);
+
+    unsigned granules = (unsigned) ((sizeof(alloc_t) + alloc->size + MEM_SMALL_GRANULE - 1) / MEM_SMALL_GRANULE);
+    _mem_bitmap_assign(run->bitmap, start, granules, 0);
+    run->free_granules += granules;
+    alloc->mem = NULL;
+
+    // update metadata (num_allocs, alloc_size)
+    --pool_mgr->pool.num_allocs;
+    pool_mgr->pool.alloc_size -= granules * MEM_SMALL_GRANULE;
+
+    // an empty run goes back to the pool, as the allocation it was carved as
+    if (--run->num_allocs == 0)
+    {
+        ++pool_mgr->pool.num_allocs;
+        pool_mgr->pool.alloc_size += MEM_SMALL_RUN_SIZE;
+
+        if (run->listed)
+        {
+            if (run->prev)
+                run->prev->next = run->next;
+            else
+                pool_mgr->small_runs = run->next;
+            if (run->next)
+                run->next->prev = run->prev;
+        }
+
+        run->owner = NULL;
+        return _mem_del_alloc_node(pool_mgr, _mem_node_at(pool_mgr, run->node_ix));
+    }
+
+    if (!run->listed)
+    {
+        run->prev = NULL;
+        run->next = pool_mgr->small_runs;
+        if (run->next)
+            run->next->prev = run;
+        pool_mgr->small_runs = run;
+        run->listed = 1;
+    }
+
+    return ALLOC_OK;
+}
+
+// the small-object run an allocation node holds, if it is one
+static small_run_pt _mem_small_run_of(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if (pool_mgr->small_obj_max == 0 || !node->allocated
+        || node->alloc_record.size != MEM_SMALL_RUN_SIZE
+        || (uintptr_t) node->alloc_record.mem % MEM_SMALL_RUN_SIZE != 0)
+        return NULL;
+
+    small_run_pt run = (small_run_pt) node->alloc_record.mem;
+    return (run->owner == pool_mgr && run->node_ix == node->slot) ? run : NULL;
+}
+
+// the segments of a run, in address order: each object over its granules,
+// and the header and free granules in between as gaps; with segments
+// NULL, they are only counted
+static unsigned _mem_inspect_run(small_run_pt run, pool_segment_pt segments)
+{
+    unsigned num = 0;
+    unsigned gap = 0;   // first granule of the current gap
+    unsigned g = MEM_SMALL_HEADER_GRANULES;
+
+    while (g < MEM_SMALL_GRANULES)
+    {
+        // skip to the next object
+        g = _mem_bitmap_find(run->bitmap, MEM_SMALL_GRANULES, g, 1);
+        if (g == MEM_SMALL_GRANULES)
+            break;
+
+        alloc_pt record = (alloc_pt) ((char *) run + g * MEM_SMALL_GRANULE);
+        unsigned granules = (unsigned) ((sizeof(alloc_t) + record->size + MEM_SMALL_GRANULE - 1) / MEM_SMALL_GRANULE);
+
+        if (g > gap)
+        {
+            if (segments != NULL)
+                segments[num] = (pool_segment_t) { (g - gap) * MEM_SMALL_GRANULE, 0 };
+            ++num;
+        }
+        if (segments != NULL)
+            segments[num] = (pool_segment_t) { granules * MEM_SMALL_GRANULE, 1 };
+        ++num;
+
+        g += granules;
+        gap = g;
+    }
+
+    if (gap < MEM_SMALL_GRANULES)
+    {
+        if (segments != NULL)
+            segments[num] = (pool_segment_t) { (MEM_SMALL_GRANULES - gap) * MEM_SMALL_GRANULE, 0 };
+        ++num;
+    }
+
+    return num;
+}
+
+// the first bit at or after from which is set (or clear), or num_bits
+static unsigned _mem_bitmap_find(const uint64_t *map, unsigned num_bits, unsigned from, int set)
+{
+    if (from >= num_bits)
+        return num_bits;
+
+    unsigned word = from / 64;
+    uint64_t bits = (set ? map[word] : ~map[word]) & (~(uint64_t) 0 << (from % 64));
+
+    while (bits == 0)
+    {
+        if (++word >= num_bits / 64)
+            return num_bits;
+        bits = set ? map[word] : ~map[word];
+    }
+
+    unsigned found = word * 64 + _mem_ffs64(bits);
+    return (found < num_bits) ? found : num_bits;
+}
+
+// the start of the first run of len clear bits, or UINT_MAX; jumps from
+// each clear bit to the next set one with find-first-set
+static unsigned _mem_bitmap_find_zeros(const uint64_t *map, unsigned num_bits, unsigned len)
+{
+    unsigned pos = 0;
+
+    while (pos + len <= num_bits)
+    {
+        unsigned zero = _mem_bitmap_find(map, num_bits, pos, 0);
+        if (zero + len > num_bits)
+            break;
+
+        unsigned one = _mem_bitmap_find(map, num_bits, zero, 1);
+        if (one - zero >= len)
+            return zero;
+
+        pos = one;
+    }
+
+    return UINT_MAX;
+}
+
+static void _mem_bitmap_assign(uint64_t *map, unsigned start, unsigned len, int set)
+{
+    while (len > 0)
+    {
+        unsigned bit = start % 64;
+        unsigned count = (64 - bit < len) ? 64 - bit : len;
+        uint64_t mask = ((count == 64) ? ~(uint64_t) 0 : (((uint64_t) 1 << count) - 1)) << bit;
+
+        if (set)
+            map[start / 64] |= mask;
+        else
+            map[start / 64] &= ~mask;
+
+        start += count;
+        len -= count;
+    }
+}
+
+static void _mem_release_pool_mgr(pool_mgr_pt pool_mgr)
+{
+    _mem_put_region_mem(pool_mgr->pool.mem, pool_mgr->mem_mapped);
+    for (unsigned r = 1; r < pool_mgr->num_regions; ++r)
+        _mem_put_region_mem(pool_mgr->regions[r].mem, pool_mgr->regions[r].mapped);
+    free(pool_mgr->regions);
+    for (unsigned c = 0; c < pool_mgr->node_chunks; ++c)
+        free(pool_mgr->node_heap[c]);
+    free(pool_mgr->gap_ix);
+    free(pool_mgr->addr_ix);
+    free(pool_mgr->addr_ix_mem);
+    free(pool_mgr->seg_classes);
+    free(pool_mgr->seg_heads);
+    free(pool_mgr->tlsf_heads);
+    free(pool_mgr->buddy_map);
+    free(pool_mgr->buddy_free);
+    free(pool_mgr);
+}
+
+// pop an unused node off the free list (the caller makes sure there is one)
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr)
+{
+    node_pt node = pool_mgr->node_free;
+    assert(node != NULL && node->used == 0);
+
+    pool_mgr->node_free = _mem_node_at(pool_mgr, node->next);
+    node->next = MEM_NODE_NIL;
+
+    return node;
+}
+
+// push a node that has been unlinked from the list back on the free list
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node->used = 0;
+    node->allocated = 0;
+    node->region_start = 0;
+    node->decommitted = 0;
+    node->prev = MEM_NODE_NIL;
+    node->next = _mem_slot_of(pool_mgr->node_free);
+    pool_mgr->node_free = node;
+    --pool_mgr->used_nodes;
+}
+
+// push the count nodes of a new chunk, starting at slot first, on the
+// free list, lowest first
+static void _mem_chain_unused_nodes(pool_mgr_pt pool_mgr, node_pt chunk, unsigned first, unsigned count)
+{
+    for (unsigned u = count; u > 0; --u)
+    {
+        chunk[u - 1].slot = first + u - 1;
+        chunk[u - 1].prev = MEM_NODE_NIL;
+        chunk[u - 1].next = _mem_slot_of(pool_mgr->node_free);
+        pool_mgr->node_free = &chunk[u - 1];
+    }
+}
+
+static alloc_status _mem_init_seg_classes(pool_mgr_pt pool_mgr, const pool_opts_t *opts)
+{
+    const size_t *classes = MEM_SEG_DEFAULT_CLASSES;
+    unsigned num_classes = sizeof(MEM_SEG_DEFAULT_CLASSES) / sizeof(size_t);
+
+    if (opts != NULL && opts->size_classes != NULL)
+    {
+        classes = opts->size_classes;
+        num_classes = opts->num_size_classes;
+    }
+
+    // one bit per class in seg_map, bounds have to be strictly ascending
+    if (num_classes == 0 || num_classes > MEM_SEG_MAX_CLASSES)
+        return ALLOC_FAIL;
+    for (unsigned u = 1; u < num_classes; ++u)
+        if (classes[u] <= classes[u - 1])
+            return ALLOC_FAIL;
+
+    pool_mgr->seg_classes = (size_t *) calloc(num_classes, sizeof(size_t));
+    pool_mgr->seg_heads = (unsigned *) calloc(num_classes, sizeof(unsigned));
+    if (pool_mgr->seg_classes == NULL || pool_mgr->seg_heads == NULL)
+    {
+        free(pool_mgr->seg_classes);
+        free(pool_mgr->seg_heads);
+        return ALLOC_FAIL;
+    }
+
+    for (unsigned u = 0; u < num_classes; ++u)
+    {
+        pool_mgr->seg_classes[u] = classes[u];
+        pool_mgr->seg_heads[u] = MEM_GAP_IX_NIL;
+    }
+    pool_mgr->seg_num_classes = num_classes;
+    pool_mgr->seg_map = 0;
+
+    return ALLOC_OK;
+}
+
+// the class holding gaps of this size: the last one whose lower bound
+// is not above it (sizes below the first bound go to the first class)
+static unsigned _mem_seg_class(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned lo = 0, hi = pool_mgr->seg_num_classes;
+
+    while (hi - lo > 1)
+    {
+        unsigned mid = (lo + hi) / 2;
+        if (pool_mgr->seg_classes[mid] <= size)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void _mem_seg_push(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned cls = _mem_seg_class(pool_mgr, pool_mgr->gap_ix[slot].size);
+
+    _mem_gap_list_push(pool_mgr, &pool_mgr->seg_heads[cls], slot);
+    pool_mgr->seg_map |= (uint64_t) 1 << cls;
+}
+
+static void _mem_seg_unlink(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned cls = _mem_seg_class(pool_mgr, pool_mgr->gap_ix[slot].size);
+
+    if (_mem_gap_list_unlink(pool_mgr, &pool_mgr->seg_heads[cls], slot))
+        pool_mgr->seg_map &= ~((uint64_t) 1 << cls);
+}
+
+// a sufficient gap from the class lists, or NULL
+// every gap in a class above the size's own class fits, so the common case
+// is a single bitmap lookup; only the size's own class is searched
+static node_pt _mem_find_seg_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+    unsigned cls = _mem_seg_class(pool_mgr, size);
+    unsigned head = pool_mgr->seg_heads[cls];
+
+    // the head of the own class, if it fits
+    if (head != MEM_GAP_IX_NIL && ix[head].size >= size)
+        return ix[head].node;
+
+    // the first gap of the next non-empty class above
+    uint64_t above = (cls + 1 < MEM_SEG_MAX_CLASSES)
+                     ? pool_mgr->seg_map & ~(((uint64_t) 2 << cls) - 1)
+                     : 0;
+    if (above)
+        return ix[pool_mgr->seg_heads[_mem_ffs64(above)]].node;
+
+    // the rest of the own class
+    for (unsigned slot = head; slot != MEM_GAP_IX_NIL; slot = ix[slot].right)
+        if (ix[slot].size >= size)
+            return ix[slot].node;
+
+    return NULL;
+}
+
+static void _mem_gap_list_push(pool_mgr_pt pool_mgr, unsigned *head, unsigned slot)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+
+    ix[slot].left = MEM_GAP_IX_NIL;
+    ix[slot].right = *head;
+    if (*head != MEM_GAP_IX_NIL)
+        ix[*head].left = slot;
+
+    *head = slot;
+}
+
+// unlink slot from the list at head, return whether the list is now empty
+static int _mem_gap_list_unlink(pool_mgr_pt pool_mgr, unsigned *head, unsigned slot)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+    unsigned prev = ix[slot].left, next = ix[slot].right;
+
+    if (next != MEM_GAP_IX_NIL)
+        ix[next].left = prev;
+
+    if (prev != MEM_GAP_IX_NIL)
+        ix[prev].right = next;
+    else
+        *head = next;
+
+    return *head == MEM_GAP_IX_NIL;
+}
+
+static alloc_status _mem_init_tlsf(pool_mgr_pt pool_mgr)
+{
+    unsigned num_classes = MEM_TLSF_FL_COUNT * MEM_TLSF_SL_COUNT;
+
+    pool_mgr->tlsf_heads = (unsigned *) calloc(num_classes, sizeof(unsigned));
+    if (pool_mgr->tlsf_heads == NULL)
+        return ALLOC_FAIL;
+
+    for (unsigned u = 0; u < num_classes; ++u)
+        pool_mgr->tlsf_heads[u] = MEM_GAP_IX_NIL;
+
+    return ALLOC_OK;
+}
+
+// the (fl, sl) class of a gap of this size: fl is the power-of-two range
+// (0 for the sizes below MEM_TLSF_SL_COUNT), sl the linear subdivision of it
+static void _mem_tlsf_mapping(size_t size, unsigned *fl, unsigned *sl)
+{
+    if (size < MEM_TLSF_SL_COUNT)
+    {
+        *fl = 0;
+        *sl = (unsigned) size;
+    }
+    else
+    {
+        unsigned msb = _mem_fls64(size);
+        *fl = msb - MEM_TLSF_SL_LOG2 + 1;
+        *sl = (unsigned) (size >> (msb - MEM_TLSF_SL_LOG2)) - MEM_TLSF_SL_COUNT;
+    }
+}
+
+static void _mem_tlsf_push(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned fl, sl;
+    _mem_tlsf_mapping(pool_mgr->gap_ix[slot].size, &fl, &sl);
+
+    _mem_gap_list_push(pool_mgr, &pool_mgr->tlsf_heads[fl * MEM_TLSF_SL_COUNT + sl], slot);
+    pool_mgr->tlsf_sl_map[fl] |= (uint32_t) 1 << sl;
+    pool_mgr->tlsf_fl_map |= (uint64_t) 1 << fl;
+}
+
+static void _mem_tlsf_unlink(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned fl, sl;
+    _mem_tlsf_mapping(pool_mgr->gap_ix[slot].size, &fl, &sl);
+
+    if (_mem_gap_list_unlink(pool_mgr, &pool_mgr->tlsf_heads[fl * MEM_TLSF_SL_COUNT + sl], slot))
+    {
+        pool_mgr->tlsf_sl_map[fl] &= ~((uint32_t) 1 << sl);
+        if (pool_mgr->tlsf_sl_map[fl] == 0)
+            pool_mgr->tlsf_fl_map &= ~((uint64_t) 1 << fl);
+    }
+}
+
+// the head of the first non-empty class whose gaps all fit, or else the
+// head of the size's own class if it fits, or NULL; two find-first-set
+// lookups and a look at one head, no list is ever searched
+static node_pt _mem_find_tlsf_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    if (size > pool_mgr->pool.total_size)
+        return NULL;
+
+    unsigned fl, sl;
+    _mem_tlsf_mapping(size, &fl, &sl);
+    unsigned own = pool_mgr->tlsf_heads[fl * MEM_TLSF_SL_COUNT + sl];
+
+    // round up to the next class boundary, so that any gap in the class fits
+    size_t rounded = size;
+    if (size >= MEM_TLSF_SL_COUNT)
+        rounded += ((size_t) 1 << (_mem_fls64(size) - MEM_TLSF_SL_LOG2)) - 1;
+    _mem_tlsf_mapping(rounded, &fl, &sl);
+
+    uint32_t sl_map = pool_mgr->tlsf_sl_map[fl] & (~(uint32_t) 0 << sl);
+    if (sl_map == 0)
+    {
+        uint64_t fl_map = (fl + 1 < MEM_TLSF_FL_COUNT)
+                          ? pool_mgr->tlsf_fl_map & (~(uint64_t) 0 << (fl + 1))
+                          : 0;
+        if (fl_map != 0)
+        {
+            fl = _mem_ffs64(fl_map);
+            sl_map = pool_mgr->tlsf_sl_map[fl];
+        }
+    }
+    if (sl_map != 0)
+        return pool_mgr->gap_ix[pool_mgr->tlsf_heads[fl * MEM_TLSF_SL_COUNT + _mem_ffs64(sl_map)]].node;
+
+    // the own class may still hold a gap that fits, such as the last one
+    if (own != MEM_GAP_IX_NIL && pool_mgr->gap_ix[own].size >= size)
+        return pool_mgr->gap_ix[own].node;
+
+    return NULL;
+}
+
+// the first sufficient gap in address order from the cursor on, wrapping
+// around to the top of the pool, or NULL; the cursor always is a used node
+// or NULL (past the end), since merges move it to the surviving node
+static node_pt _mem_find_next_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    char *from = pool_mgr->cursor ? pool_mgr->cursor->alloc_record.mem : NULL;
+    node_pt found = _mem_find_first_gap(pool_mgr, pool_mgr->gap_ix_root, size, from);
+
+    // wrap around to the lowest address (other regions may lie below pool.mem)
+    if (found == NULL && from != NULL)
+        found = _mem_find_first_gap(pool_mgr, pool_mgr->gap_ix_root, size, NULL);
+
+    return found;
+}
+
+// the node an allocation record belongs to, if it is one of this pool's
+static node_pt _mem_node_of(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    uintptr_t addr = (uintptr_t) alloc;
+
+    // there are only a few chunks, check the address against each of them
+    for (unsigned c = 0; c < pool_mgr->node_chunks; ++c)
+    {
+        uintptr_t base = (uintptr_t) pool_mgr->node_heap[c];
+
+        if (addr >= base && addr < base + (MEM_NODE_HEAP_INIT_CAPACITY << c) * sizeof(node_t))
+            return ((addr - base) % sizeof(node_t) == 0) ? (node_pt) alloc : NULL;
+    }
+
+    return NULL;
+}
+
+// multiplicative (Fibonacci) hashing; the low bits of an address carry
+// little information, so the slot comes from the high bits of the product
+static unsigned _mem_addr_hash(const char *mem, unsigned capacity)
+{
+    uint64_t h = (uint64_t) (uintptr_t) mem * 0x9E3779B97F4A7C15ull;
+
+    return (unsigned) (h >> 32) & (capacity - 1);
+}
+
+// the caller makes sure there is a free slot (see _mem_resize_addr_ix)
+static void _mem_addr_ix_insert(pool_mgr_pt pool_mgr, node_pt node)
+{
+    unsigned mask = pool_mgr->addr_ix_capacity - 1;
+    unsigned i = _mem_addr_hash(node->alloc_record.mem, pool_mgr->addr_ix_capacity);
+
+    while (pool_mgr->addr_ix_mem[i] != NULL)
+        i = (i + 1) & mask;
+
+    pool_mgr->addr_ix_mem[i] = node->alloc_record.mem;
+    pool_mgr->addr_ix[i] = node->slot;
+    ++pool_mgr->addr_ix_count;
+}
+
+// backward-shift deletion, so that probe sequences never need tombstones
+static void _mem_addr_ix_remove(pool_mgr_pt pool_mgr, node_pt node)
+{
+    unsigned mask = pool_mgr->addr_ix_capacity - 1;
+    char *mem = node->alloc_record.mem;
+    unsigned i = _mem_addr_hash(mem, pool_mgr->addr_ix_capacity);
+
+    while (pool_mgr->addr_ix_mem[i] != mem)
+    {
+        if (pool_mgr->addr_ix_mem[i] == NULL)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    // pull back every later entry of the run whose home slot is not
+    // cyclically between the hole and its current slot
+    for (unsigned j = (i + 1) & mask; pool_mgr->addr_ix_mem[j] != NULL; j = (j + 1) & mask)
+    {
+        unsigned home = _mem_addr_hash(pool_mgr->addr_ix_mem[j], pool_mgr->addr_ix_capacity);
+
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            pool_mgr->addr_ix_mem[i] = pool_mgr->addr_ix_mem[j];
+            pool_mgr->addr_ix[i] = pool_mgr->addr_ix[j];
+            i = j;
+        }
+    }
+
+    pool_mgr->addr_ix_mem[i] = NULL;
+    pool_mgr->addr_ix[i] = MEM_ADDR_IX_NIL;
+    --pool_mgr->addr_ix_count;
+}
+
+// only the keys are probed; the node is read once its address matched
+static node_pt _mem_addr_ix_find(pool_mgr_pt pool_mgr, const char *mem)
+{
+    unsigned mask = pool_mgr->addr_ix_capacity - 1;
+
+    for (unsigned i = _mem_addr_hash(mem, pool_mgr->addr_ix_capacity);
+         pool_mgr->addr_ix_mem[i] != NULL; i = (i + 1) & mask)
+    {
+        if (pool_mgr->addr_ix_mem[i] == mem)
+            return _mem_node_at(pool_mgr, pool_mgr->addr_ix[i]);
+    }
+
+    return NULL;
+}
+
+// index of the lowest set bit (word must not be zero)
+static unsigned _mem_ffs64(uint64_t word)
+{
+#if defined(__GNUC__)
+    return (unsigned) __builtin_ctzll(word);
+#else
+    unsigned bit = 0;
+    while (!(word & 1))
+    {
+        word >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// index of the highest set bit (word must not be zero)
+static unsigned _mem_fls64(uint64_t word)
+{
+#if defined(__GNUC__)
+    return 63 - (unsigned) __builtin_clzll(word);
+#else
+    unsigned bit = 0;
+    while (word >>= 1)
+        ++bit;
+    return bit;
+#endif
+}
+
+// (size, address) order for BEST_FIT, address order for the others
+static int _mem_gap_cmp(pool_mgr_pt pool_mgr, const gap_t *a, const gap_t *b)
+{
+    if (pool_mgr->pool.policy == BEST_FIT && a->size != b->size)
+        return (a->size < b->size) ? -1 : 1;
+
+    char *a_mem = a->node->alloc_record.mem;
+    char *b_mem = b->node->alloc_record.mem;
+    if (a_mem != b_mem)
+        return (a_mem < b_mem) ? -1 : 1;
+
+    return 0;
+}
+
+// the lowest-addressed gap of at least size bytes at or after from (NULL for
+// anywhere), in the address-ordered tree; an entry's child maxima decide
+// where to go next without touching the children, so a search from the top
+// is a single loop reading one entry per level
+static node_pt _mem_find_first_gap(pool_mgr_pt pool_mgr, unsigned root,
+                                   size_t size, const char *from)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+
+    while (root != MEM_GAP_IX_NIL)
+    {
+        gap_pt gap = &ix[root];
+
+        if (from != NULL && gap->node->alloc_record.mem < from)
+        {
+            // everything on the left is before from
+            if (gap->right_max < size)
+                return NULL;
+            root = gap->right;
+            continue;
+        }
+
+        if (gap->left_max >= size)
+        {
+            // with no lower bound, a fit on the left is certain to be found
+            if (from == NULL)
+            {
+                root = gap->left;
+                continue;
+            }
+
+            node_pt found = _mem_find_first_gap(pool_mgr, gap->left, size, from);
+            if (found)
+                return found;
+        }
+        if (gap->size >= size)
+            return gap->node;
+        if (gap->right_max < size)
+            return NULL;
+
+        root = gap->right;
+    }
+
+    return NULL;
+}
+
+static unsigned _mem_gap_height(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    return (slot == MEM_GAP_IX_NIL) ? 0 : pool_mgr->gap_ix[slot].height;
+}
+
+// the largest gap size in the subtree at slot, 0 if empty
+static size_t _mem_gap_max(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    if (slot == MEM_GAP_IX_NIL)
+        return 0;
+
+    gap_pt gap = &pool_mgr->gap_ix[slot];
+    size_t max = gap->size;
+    if (gap->left_max > max)
+        max = gap->left_max;
+    if (gap->right_max > max)
+        max = gap->right_max;
+
+    return max;
+}
+
+static void _mem_gap_update(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    gap_pt gap = &pool_mgr->gap_ix[slot];
+    unsigned hl = _mem_gap_height(pool_mgr, gap->left);
+    unsigned hr = _mem_gap_height(pool_mgr, gap->right);
+
+    gap->height = 1 + ((hl > hr) ? hl : hr);
+
+    gap->left_max = _mem_gap_max(pool_mgr, gap->left);
+    gap->right_max = _mem_gap_max(pool_mgr, gap->right);
+}
+
+// rotate the subtree at slot to the left (or right), return the new root
+static unsigned _mem_gap_rotate(pool_mgr_pt pool_mgr, unsigned slot, int left)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+    unsigned pivot;
+
+    if (left)
+    {
+        pivot = ix[slot].right;
+        ix[slot].right = ix[pivot].left;
+        ix[pivot].left = slot;
+    }
+    else
+    {
+        pivot = ix[slot].left;
+        ix[slot].left = ix[pivot].right;
+        ix[pivot].right = slot;
+    }
+
+    _mem_gap_update(pool_mgr, slot);
+    _mem_gap_update(pool_mgr, pivot);
+
+    return pivot;
+}
+
+static unsigned _mem_gap_balance(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+
+    _mem_gap_update(pool_mgr, slot);
+
+    int balance = (int) _mem_gap_height(pool_mgr, ix[slot].left)
+                  - (int) _mem_gap_height(pool_mgr, ix[slot].right);
+
+    if (balance > 1)
+    {
+        unsigned l = ix[slot].left;
+        if (_mem_gap_height(pool_mgr, ix[l].left) < _mem_gap_height(pool_mgr, ix[l].right))
+            ix[slot].left = _mem_gap_rotate(pool_mgr, l, 1);
+        return _mem_gap_rotate(pool_mgr, slot, 0);
+    }
+
+    if (balance < -1)
+    {
+        unsigned r = ix[slot].right;
+        if (_mem_gap_height(pool_mgr, ix[r].right) < _mem_gap_height(pool_mgr, ix[r].left))
+            ix[slot].right = _mem_gap_rotate(pool_mgr, r, 0);
+        return _mem_gap_rotate(pool_mgr, slot, 1);
     }
+
+    return slot;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr, size_t size, node_pt node)
+static unsigned _mem_gap_insert(pool_mgr_pt pool_mgr, unsigned root, unsigned slot)
 {
-    // expand the gap index, if necessary (call the function)
-    _mem_resize_gap_ix(pool_mgr);
+    if (root == MEM_GAP_IX_NIL)
+        return slot;
 
-    // add the entry at the end
-    int i = 0;
-    while (pool_mgr->gap_ix[i].node != NULL)
-        ++i;
+    gap_pt ix = pool_mgr->gap_ix;
 
-    pool_mgr->gap_ix[i].node = node;
-    pool_mgr->gap_ix[i].size = size;
+    if (_mem_gap_cmp(pool_mgr, &ix[slot], &ix[root]) < 0)
+        ix[root].left = _mem_gap_insert(pool_mgr, ix[root].left, slot);
+    else
+        ix[root].right = _mem_gap_insert(pool_mgr, ix[root].right, slot);
 
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps++;
+    return _mem_gap_balance(pool_mgr, root);
+}
 
-    // sort the gap index (call the function)
-    // check success
-    if (pool_mgr->gap_ix[i].node != NULL)
+// detach the minimum of the subtree at root into *min, return the new root
+static unsigned _mem_gap_remove_min(pool_mgr_pt pool_mgr, unsigned root, unsigned *min)
+{
+    gap_pt ix = pool_mgr->gap_ix;
+
+    if (ix[root].left == MEM_GAP_IX_NIL)
     {
-        _mem_sort_gap_ix(pool_mgr);
-        return ALLOC_OK;
+        *min = root;
+        return ix[root].right;
     }
 
+    ix[root].left = _mem_gap_remove_min(pool_mgr, ix[root].left, min);
+
+    return _mem_gap_balance(pool_mgr, root);
+}
+
+// detach the entry matching key into *removed, return the new root
+static unsigned _mem_gap_remove(pool_mgr_pt pool_mgr, unsigned root,
+                                const gap_t *key, unsigned *removed)
+{
+    if (root == MEM_GAP_IX_NIL)
+        return MEM_GAP_IX_NIL;
+
+    gap_pt ix = pool_mgr->gap_ix;
+    int cmp = _mem_gap_cmp(pool_mgr, key, &ix[root]);
+
+    if (cmp < 0)
+        ix[root].left = _mem_gap_remove(pool_mgr, ix[root].left, key, removed);
+    else if (cmp > 0)
+        ix[root].right = _mem_gap_remove(pool_mgr, ix[root].right, key, removed);
     else
+    {
+        *removed = root;
+
+        if (ix[root].left == MEM_GAP_IX_NIL)
+            return ix[root].right;
+        if (ix[root].right == MEM_GAP_IX_NIL)
+            return ix[root].left;
+
+        // replace with the in-order successor
+        unsigned successor;
+        unsigned right = _mem_gap_remove_min(pool_mgr, ix[root].right, &successor);
+        ix[successor].left = ix[root].left;
+        ix[successor].right = right;
+        root = successor;
+    }
+
+    return _mem_gap_balance(pool_mgr, root);
+}
+
+// split the pool into the largest aligned power-of-two blocks that fit,
+// in descending order; the bytes after the last whole unit are not managed
+static alloc_status _mem_init_buddy(pool_mgr_pt pool_mgr)
+{
+    size_t units = pool_mgr->pool.total_size / MEM_BUDDY_MIN_BLOCK;
+
+    if (units == 0)
+        return ALLOC_FAIL;
+
+    pool_mgr->buddy_map = (unsigned char *) calloc(units, sizeof(unsigned char));
+    pool_mgr->buddy_free = (char **) calloc(MEM_BUDDY_MAX_ORDERS, sizeof(char *));
+    if (pool_mgr->buddy_map == NULL || pool_mgr->buddy_free == NULL)
         return ALLOC_FAIL;
+
+    pool_mgr->buddy_units = units;
+    pool_mgr->buddy_free_map = 0;
+    pool_mgr->pool.total_size = units * MEM_BUDDY_MIN_BLOCK;
+
+    _mem_buddy_carve(pool_mgr);
+
+    return ALLOC_OK;
+}
+static void _mem_buddy_carve(pool_mgr_pt pool_mgr)
+{
+    // each block starts at a multiple of twice its size, so its buddy
+    // would extend past the end and it never coalesces further
+    size_t unit = 0;
+    for (unsigned order = MEM_BUDDY_MAX_ORDERS; order-- > 0; )
+    {
+        if (pool_mgr->buddy_units & ((size_t) 1 << order))
+        {
+            _mem_buddy_push(pool_mgr, unit, order);
+            unit += (size_t) 1 << order;
+        }
+    }
 }
+static void _mem_reset_buddy(pool_mgr_pt pool_mgr)
+{
+    // walk the blocks in address order, clearing their starts in the map;
+    // the record of an allocated block is found through the address index
+    // and dropped from it, so the cost is in the blocks, not the pool or
+    // index size
+    size_t unit = 0;
+    for (unsigned i = 0; i < pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps; ++i)
+    {
+        unsigned char entry = pool_mgr->buddy_map[unit];
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr, size_t size, node_pt node)
+        if (!(entry & MEM_BUDDY_FREE))
+        {
+            node_pt node = _mem_addr_ix_find(pool_mgr, pool_mgr->pool.mem + unit * MEM_BUDDY_MIN_BLOCK);
+            ++node->gen;
+            _mem_addr_ix_remove(pool_mgr, node);
+            _mem_put_unused_node(pool_mgr, node);
+        }
+
+        pool_mgr->buddy_map[unit] = 0;
+        unit += (size_t) 1 << (entry & MEM_BUDDY_ORDER_MASK);
+    }
+
+    // start over from the initial blocks
+    for (unsigned order = 0; order < MEM_BUDDY_MAX_ORDERS; ++order)
+        pool_mgr->buddy_free[order] = NULL;
+    pool_mgr->buddy_free_map = 0;
+    pool_mgr->pool.num_gaps = 0;
+
+    _mem_buddy_carve(pool_mgr);
+}
+
+static void _mem_buddy_push(pool_mgr_pt pool_mgr, size_t unit, unsigned order)
 {
-    int i = 0;
-    if(i == 0)
-        while (pool_mgr->gap_ix[i].node != node)
-            ++i;
+    char *block = pool_mgr->pool.mem + unit * MEM_BUDDY_MIN_BLOCK;
+    buddy_link_pt link = (buddy_link_pt) block;
+    char *head = pool_mgr->buddy_free[order];
+
+    link->prev = NULL;
+    link->next = head;
+    if (head)
+        ((buddy_link_pt) head)->prev = block;
+
+    pool_mgr->buddy_free[order] = block;
+    pool_mgr->buddy_free_map |= (uint64_t) 1 << order;
+    pool_mgr->buddy_map[unit] = MEM_BUDDY_START | MEM_BUDDY_FREE | (unsigned char) order;
+    pool_mgr->pool.num_gaps++;
+}
+
+static void _mem_buddy_unlink(pool_mgr_pt pool_mgr, size_t unit, unsigned order)
+{
+    char *block = pool_mgr->pool.mem + unit * MEM_BUDDY_MIN_BLOCK;
+    buddy_link_pt link = (buddy_link_pt) block;
+
+    if (link->next)
+        ((buddy_link_pt) link->next)->prev = link->prev;
+
+    if (link->prev)
+        ((buddy_link_pt) link->prev)->next = link->next;
+    else
+    {
+        pool_mgr->buddy_free[order] = link->next;
+        if (link->next == NULL)
+            pool_mgr->buddy_free_map &= ~((uint64_t) 1 << order);
+    }
 
-    pool_mgr->gap_ix[i].size = 0;
-    pool_mgr->gap_ix[i].node = NULL;
+    pool_mgr->buddy_map[unit] &= (unsigned char) ~MEM_BUDDY_FREE;
     pool_mgr->pool.num_gaps--;
+}
+
+static alloc_pt _mem_new_alloc_buddy(pool_mgr_pt pool_mgr, size_t size)
+{
+    // the record needs a node, expand heap node and address index, if necessary
+    if (_mem_resize_node_heap(pool_mgr) != ALLOC_OK
+        || pool_mgr->total_nodes <= pool_mgr->used_nodes
+        || _mem_resize_addr_ix(pool_mgr, 1) != ALLOC_OK)
+        return NULL;
+
+    // the smallest order whose blocks hold size
+    unsigned order = 0;
+    while (order < MEM_BUDDY_MAX_ORDERS - 1 && (MEM_BUDDY_MIN_BLOCK << order) < size)
+        ++order;
+    if ((MEM_BUDDY_MIN_BLOCK << order) < size)
+        return NULL;
+
+    // the smallest non-empty order at least that large
+    uint64_t fits = pool_mgr->buddy_free_map & ~(((uint64_t) 1 << order) - 1);
+    if (fits == 0)
+        return NULL;
+    unsigned found = _mem_ffs64(fits);
+
+    size_t unit = (size_t) (pool_mgr->buddy_free[found] - pool_mgr->pool.mem) / MEM_BUDDY_MIN_BLOCK;
+    _mem_buddy_unlink(pool_mgr, unit, found);
+
+    // split off the upper halves until the block has the right order
+    while (found > order)
+    {
+        --found;
+        _mem_buddy_push(pool_mgr, unit + ((size_t) 1 << found), found);
+    }
+    pool_mgr->buddy_map[unit] = MEM_BUDDY_START | (unsigned char) order;
+
+    // the allocation record lives in a node, which is not on the list
+    node_pt node = _mem_get_unused_node(pool_mgr);
+    node->used = 1;
+    node->allocated = 1;
+    node->next = node->prev = MEM_NODE_NIL;
+    node->alloc_record.mem = pool_mgr->pool.mem + unit * MEM_BUDDY_MIN_BLOCK;
+    node->alloc_record.size = MEM_BUDDY_MIN_BLOCK << order;
+    ++pool_mgr->used_nodes;
+    _mem_addr_ix_insert(pool_mgr, node);
+
+    // the whole block counts as allocated
+    pool_mgr->pool.alloc_size += node->alloc_record.size;
+    ++pool_mgr->pool.num_allocs;
+
+    return (alloc_pt) node;
+}
+
+static alloc_status _mem_del_alloc_buddy(pool_mgr_pt pool_mgr, node_pt node)
+{
+    size_t unit = (size_t) (node->alloc_record.mem - pool_mgr->pool.mem) / MEM_BUDDY_MIN_BLOCK;
+    unsigned order = pool_mgr->buddy_map[unit] & MEM_BUDDY_ORDER_MASK;
+
+    pool_mgr->pool.alloc_size -= node->alloc_record.size;
+    --pool_mgr->pool.num_allocs;
+
+    ++node->gen;
+    _mem_addr_ix_remove(pool_mgr, node);
+    _mem_put_unused_node(pool_mgr, node);
+
+    // merge with the buddy while it is a whole free block of the same order
+    while (order < MEM_BUDDY_MAX_ORDERS - 1)
+    {
+        size_t buddy = unit ^ ((size_t) 1 << order);
+
+        if (buddy + ((size_t) 1 << order) > pool_mgr->buddy_units
+            || pool_mgr->buddy_map[buddy] != (MEM_BUDDY_START | MEM_BUDDY_FREE | order))
+            break;
+
+        _mem_buddy_unlink(pool_mgr, buddy, order);
+
+        // the upper half stops being a block start
+        size_t upper = (buddy > unit) ? buddy : unit;
+        pool_mgr->buddy_map[upper] = 0;
+        unit = (buddy < unit) ? buddy : unit;
+        ++order;
+    }
+
+    _mem_buddy_push(pool_mgr, unit, order);
+
+    return ALLOC_OK;
+}
+
+// one segment per block, walking the block starts in address order
+static void _mem_inspect_buddy(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments)
+{
+    unsigned count = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(count, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    size_t unit = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned char entry = pool_mgr->buddy_map[unit];
+        unsigned order = entry & MEM_BUDDY_ORDER_MASK;
+
+        segmentArr[i].size = MEM_BUDDY_MIN_BLOCK << order;
+        segmentArr[i].allocated = (entry & MEM_BUDDY_FREE) ? 0 : 1;
+        unit += (size_t) 1 << order;
+    }
+
+    *segments = segmentArr;
+    *num_segments = count;
+}
+
+// one node per object, all of them on the free list in address order
+static alloc_status _mem_init_slab(pool_mgr_pt pool_mgr, const pool_opts_t *opts)
+{
+    if (opts == NULL || opts->slab_obj_size == 0
+        || pool_mgr->pool.total_size / opts->slab_obj_size > UINT_MAX)
+        return ALLOC_FAIL;
+
+    size_t obj_size = opts->slab_obj_size;
+    unsigned count = (unsigned) (pool_mgr->pool.total_size / obj_size);
+    if (count == 0)
+        return ALLOC_FAIL;
+
+    // the node heap is grown once, up front, to a node per object;
+    // SLAB pools do not use the free list of unused nodes
+    while (pool_mgr->total_nodes < count)
+        if (_mem_add_node_chunk(pool_mgr) != ALLOC_OK)
+            return ALLOC_FAIL;
+    pool_mgr->node_free = NULL;
+    pool_mgr->used_nodes = count;
+
+    node_pt next = NULL;
+    for (unsigned u = count; u > 0; --u)
+    {
+        node_pt node = _mem_node_at(pool_mgr, u - 1);
+        node->used = 1;
+        node->alloc_record.mem = pool_mgr->pool.mem + (u - 1) * obj_size;
+        node->alloc_record.size = obj_size;
+        node->next = _mem_slot_of(next);
+        next = node;
+    }
+
+    pool_mgr->slab_obj_size = obj_size;
+    pool_mgr->slab_free = next;
+    pool_mgr->pool.total_size = count * obj_size;
+    pool_mgr->pool.num_gaps = count;
+
+    return ALLOC_OK;
+}
+
+static alloc_pt _mem_new_alloc_slab(pool_mgr_pt pool_mgr, size_t size)
+{
+    node_pt node = pool_mgr->slab_free;
+
+    if (node == NULL || size > pool_mgr->slab_obj_size)
+        return NULL;
+
+    pool_mgr->slab_free = _mem_node_at(pool_mgr, node->next);
+    node->next = MEM_NODE_NIL;
+    node->allocated = 1;
+
+    pool_mgr->pool.alloc_size += pool_mgr->slab_obj_size;
+    ++pool_mgr->pool.num_allocs;
+    --pool_mgr->pool.num_gaps;
+
+    return (alloc_pt) node;
+}
+
+static alloc_status _mem_del_alloc_slab(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node->allocated = 0;
+    ++node->gen;
+    node->next = _mem_slot_of(pool_mgr->slab_free);
+    pool_mgr->slab_free = node;
+
+    pool_mgr->pool.alloc_size -= pool_mgr->slab_obj_size;
+    --pool_mgr->pool.num_allocs;
+    ++pool_mgr->pool.num_gaps;
+
+    return ALLOC_OK;
+}
+
+static void _mem_reset_slab(pool_mgr_pt pool_mgr)
+{
+    // every object is free again, the free list in address order
+    node_pt next = NULL;
+    for (unsigned u = pool_mgr->used_nodes; u > 0; --u)
+    {
+        node_pt node = _mem_node_at(pool_mgr, u - 1);
+        if (node->allocated)
+            ++node->gen;
+        node->allocated = 0;
+        node->next = _mem_slot_of(next);
+        next = node;
+    }
+
+    pool_mgr->slab_free = next;
+    pool_mgr->pool.num_gaps = pool_mgr->used_nodes;
+}
+
+// ARENA and STACK records are inline, each in front of its memory, at
+// offsets aligned to sizeof(alloc_t); the memory may be further on for
+// alignment. The offset only moves on, alloc_size counts every byte below
+// it (records and padding as well)
+static alloc_pt _mem_bump(pool_mgr_pt pool_mgr, size_t header, size_t size, size_t alignment)
+{
+    size_t offset = pool_mgr->arena_offset;
+    size_t total_size = pool_mgr->pool.total_size;
+
+    // the memory starts after the header, at the alignment asked for
+    uintptr_t base = (uintptr_t) pool_mgr->pool.mem;
+    uintptr_t mem = base + offset + header;
+    if (alignment > 1)
+        mem = (mem + alignment - 1) & ~(uintptr_t) (alignment - 1);
+
+    // check that it fits
+    size_t start = (size_t) (mem - base);
+    if (mem < base || start > total_size || size > total_size - start)
+        return NULL;
+
+    // the next record goes after it, aligned again
+    size_t next = start + size;
+    next += (sizeof(alloc_t) - next % sizeof(alloc_t)) % sizeof(alloc_t);
+    if (next > total_size)
+        next = total_size;
+
+    alloc_pt record = (alloc_pt) (pool_mgr->pool.mem + offset);
+    record->size = size;
+    record->mem = (char *) mem;
+
+    // update metadata (alloc_size, num_gaps)
+    pool_mgr->arena_offset = next;
+    pool_mgr->pool.alloc_size += next - offset;
+    pool_mgr->pool.num_gaps = (next < total_size) ? 1 : 0;
+
+    return record;
+}
+static alloc_pt _mem_new_alloc_arena(pool_mgr_pt pool_mgr, size_t size, size_t alignment)
+{
+    alloc_pt record = _mem_bump(pool_mgr, sizeof(alloc_t), size, alignment);
+
+    if (record != NULL)
+        ++pool_mgr->pool.num_allocs;
+
+    return record;
+}
+
+// one segment per record, with its padding, and the rest as a gap
+static void _mem_inspect_arena(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments)
+{
+    unsigned num = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(num ? num : 1, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    size_t offset = 0;
+    for (unsigned u = 0; u < pool_mgr->pool.num_allocs; ++u)
+    {
+        alloc_pt record = (alloc_pt) (pool_mgr->pool.mem + offset);
+        size_t next = (size_t) (record->mem - pool_mgr->pool.mem) + record->size;
+        next += (sizeof(alloc_t) - next % sizeof(alloc_t)) % sizeof(alloc_t);
+        if (next > pool_mgr->pool.total_size)
+            next = pool_mgr->pool.total_size;
+
+        segmentArr[u].size = next - offset;
+        segmentArr[u].allocated = 1;
+        offset = next;
+    }
+    if (pool_mgr->pool.num_gaps != 0)
+        segmentArr[num - 1].size = pool_mgr->pool.total_size - offset;
+
+    *segments = segmentArr;
+    *num_segments = num;
+}
+
+// STACK records link to the one below, so the top one can be popped
+static alloc_pt _mem_new_alloc_stack(pool_mgr_pt pool_mgr, size_t size, size_t alignment)
+{
+    size_t offset = pool_mgr->arena_offset;
+    stack_record_pt record = (stack_record_pt) _mem_bump(pool_mgr, sizeof(stack_record_t), size, alignment);
+
+    if (record == NULL)
+        return NULL;
+
+    record->prev = pool_mgr->stack_top;
+    pool_mgr->stack_top = offset;
+    ++pool_mgr->pool.num_allocs;
+
+    return &record->alloc_record;
+}
+static alloc_status _mem_del_alloc_stack(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    // only the top record can be freed, and not if it is a frame
+    if (pool_mgr->stack_top == MEM_STACK_NIL
+        || (char *) alloc != pool_mgr->pool.mem + pool_mgr->stack_top
+        || alloc->mem == NULL)
+        return ALLOC_FAIL;
+
+    stack_record_pt record = (stack_record_pt) alloc;
+
+    // update metadata (num_allocs, alloc_size, num_gaps)
+    pool_mgr->pool.alloc_size -= pool_mgr->arena_offset - pool_mgr->stack_top;
+    --pool_mgr->pool.num_allocs;
+    pool_mgr->pool.num_gaps = 1;
+
+    pool_mgr->arena_offset = pool_mgr->stack_top;
+    pool_mgr->stack_top = record->prev;
 
     return ALLOC_OK;
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr)
+// one segment per record (frames included), bottom up, and the rest as a gap
+static void _mem_inspect_stack(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments)
 {
-    int i = pool_mgr->pool.num_gaps - 1;
+    // frames are not allocations, so each is listed as part of the
+    // allocation below it (or above it, at the bottom of the stack); with
+    // no allocation at all, the frames are one allocated segment, as they
+    // count in alloc_size
+    unsigned num_records = pool_mgr->pool.num_allocs;
+    if (num_records == 0 && pool_mgr->stack_top != MEM_STACK_NIL)
+        num_records = 1;
+    unsigned num = num_records + pool_mgr->pool.num_gaps;
+
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(num ? num : 1, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    if (pool_mgr->pool.num_gaps != 0)
+        segmentArr[num - 1].size = pool_mgr->pool.total_size - pool_mgr->arena_offset;
 
-    for (i; i >=0; --i)
+    // each record reaches up to the one above it
+    unsigned u = num_records;
+    size_t above = pool_mgr->arena_offset;
+    size_t size = 0;     // with the frames above, not listed yet
+    for (size_t offset = pool_mgr->stack_top; offset != MEM_STACK_NIL; )
     {
-        if (pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i+1].size)
+        stack_record_pt record = (stack_record_pt) (pool_mgr->pool.mem + offset);
+
+        size += above - offset;
+        if (record->alloc_record.mem != NULL)
         {
-            gap_t temp = pool_mgr->gap_ix[i];
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i + 1];
-            pool_mgr->gap_ix[i + 1] = temp;
+            --u;
+            segmentArr[u].size = size;
+            segmentArr[u].allocated = 1;
+            size = 0;
         }
+        above = offset;
+        offset = record->prev;
+    }
 
-        //Allows 13 to pass but fails more tests
-        /*else if (pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i+1].size
-                 && &pool_mgr->gap_ix[i].node < &pool_mgr->gap_ix[i+1].node)
-        {
-            gap_t temp = pool_mgr->gap_ix[i];
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i + 1];
-            pool_mgr->gap_ix[i + 1] = temp;
-        }*/
+    // the frames below the first allocation join the segment above them
+    if (size != 0)
+    {
+        segmentArr[0].size += size;
+        segmentArr[0].allocated = 1;
+    }
+
+    *segments = segmentArr;
+    *num_segments = num;
+}
+
+// the whole pool as one free block, in MEM_TAG_ALIGN units (the bytes
+// past the last unit are not used)
+static void _mem_init_tags(pool_mgr_pt pool_mgr)
+{
+    for (unsigned c = 0; c < MEM_TAG_CLASSES; ++c)
+        pool_mgr->tag_free[c] = NULL;
+    pool_mgr->tag_free_map = 0;
+    pool_mgr->pool.num_gaps = 0;
+    pool_mgr->pool.total_size &= ~(MEM_TAG_ALIGN - 1);
+    pool_mgr->tag_end = pool_mgr->pool.total_size;
+
+    tag_block_pt block = (tag_block_pt) pool_mgr->pool.mem;
+    block->prev_size = 0;
+    block->tag = pool_mgr->tag_end;
+    block->alloc_record.mem = NULL;
+    block->alloc_record.size = 0;
+    _mem_tag_push(pool_mgr, block);
+}
+
+static size_t _mem_tag_size(const tag_block_t *block)
+{
+    return block->tag & ~(MEM_TAG_ALIGN - 1);
+}
+
+// the block right after block, NULL at the end of the pool
+static tag_block_pt _mem_tag_next(pool_mgr_pt pool_mgr, tag_block_pt block)
+{
+    char *next = (char *) block + _mem_tag_size(block);
+
+    return (next < pool_mgr->pool.mem + pool_mgr->tag_end) ? (tag_block_pt) next : NULL;
+}
+
+static void _mem_tag_push(pool_mgr_pt pool_mgr, tag_block_pt block)
+{
+    unsigned c = _mem_fls64(_mem_tag_size(block));
+    tag_link_pt link = (tag_link_pt) (block + 1);
+
+    link->prev = NULL;
+    link->next = pool_mgr->tag_free[c];
+    if (link->next != NULL)
+        ((tag_link_pt) (link->next + 1))->prev = block;
+    pool_mgr->tag_free[c] = block;
+    pool_mgr->tag_free_map |= (uint64_t) 1 << c;
+    ++pool_mgr->pool.num_gaps;
+}
+
+static void _mem_tag_unlink(pool_mgr_pt pool_mgr, tag_block_pt block)
+{
+    unsigned c = _mem_fls64(_mem_tag_size(block));
+    tag_link_pt link = (tag_link_pt) (block + 1);
+
+    if (link->prev != NULL)
+        ((tag_link_pt) (link->prev + 1))->next = link->next;
+    else
+        pool_mgr->tag_free[c] = link->next;
+    if (link->next != NULL)
+        ((tag_link_pt) (link->next + 1))->prev = link->prev;
+
+    if (pool_mgr->tag_free[c] == NULL)
+        pool_mgr->tag_free_map &= ~((uint64_t) 1 << c);
+    --pool_mgr->pool.num_gaps;
+}
+
+// the first free block of at least size bytes in size's own class, whose
+// blocks may be too small, or else the first one of the next non-empty
+// class, whose blocks all fit
+static tag_block_pt _mem_find_tag_block(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned c = _mem_fls64(size);
+
+    for (tag_block_pt block = pool_mgr->tag_free[c]; block != NULL;
+         block = ((tag_link_pt) (block + 1))->next)
+        if (_mem_tag_size(block) >= size)
+            return block;
+
+    uint64_t map = (c + 1 < MEM_TAG_CLASSES) ? pool_mgr->tag_free_map >> (c + 1) << (c + 1) : 0;
+
+    return (map != 0) ? pool_mgr->tag_free[_mem_ffs64(map)] : NULL;
+}
+
+// the header of a live allocation record, by its place in the pool
+static tag_block_pt _mem_tag_block_of(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    char *record = (char *) alloc;
+    size_t header = sizeof(tag_block_t) - sizeof(alloc_t);
+
+    if (record < pool_mgr->pool.mem + header
+        || record > pool_mgr->pool.mem + pool_mgr->tag_end - sizeof(alloc_t)
+        || (size_t) (record - header - pool_mgr->pool.mem) % MEM_TAG_ALIGN != 0)
+        return NULL;
+
+    tag_block_pt block = (tag_block_pt) (record - header);
+    if (!(block->tag & MEM_TAG_ALLOCATED) || block->alloc_record.mem != (char *) (block + 1))
+        return NULL;
+
+    return block;
+}
+
+static alloc_pt _mem_new_alloc_tag(pool_mgr_pt pool_mgr, size_t size, size_t alignment)
+{
+    // the memory right after a header is only as aligned as the pool memory
+    if (alignment > MEM_TAG_ALIGN || (uintptr_t) pool_mgr->pool.mem % alignment != 0
+        || size > pool_mgr->tag_end)
+        return NULL;
+
+    // the block holds the header and the memory, and its links once free
+    size_t need = (sizeof(tag_block_t) + size + MEM_TAG_ALIGN - 1) & ~(MEM_TAG_ALIGN - 1);
+    if (need < MEM_TAG_MIN_BLOCK)
+        need = MEM_TAG_MIN_BLOCK;
+
+    tag_block_pt block = _mem_find_tag_block(pool_mgr, need);
+    if (block == NULL)
+        return NULL;
+    _mem_tag_unlink(pool_mgr, block);
+
+    // split the rest off as a free block, if it can hold one
+    size_t block_size = _mem_tag_size(block);
+    if (block_size - need >= MEM_TAG_MIN_BLOCK)
+    {
+        tag_block_pt rest = (tag_block_pt) ((char *) block + need);
+        rest->prev_size = need;
+        rest->tag = block_size - need;
+        rest->alloc_record.mem = NULL;
+        rest->alloc_record.size = 0;
+
+        tag_block_pt next = _mem_tag_next(pool_mgr, rest);
+        if (next != NULL)
+            next->prev_size = rest->tag;
+        _mem_tag_push(pool_mgr, rest);
+
+        block_size = need;
+    }
+
+    block->tag = block_size | MEM_TAG_ALLOCATED;
+    block->alloc_record.mem = (char *) (block + 1);
+    block->alloc_record.size = size;
+
+    // update metadata (num_allocs, alloc_size), alloc_size counts the block
+    pool_mgr->pool.alloc_size += block_size;
+    ++pool_mgr->pool.num_allocs;
+
+    return &block->alloc_record;
+}
+
+// merge with the free neighbours, whose headers are right at the end of
+// the block and prev_size bytes before it
+static alloc_status _mem_del_alloc_tag(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    tag_block_pt block = _mem_tag_block_of(pool_mgr, alloc);
+    if (block == NULL)
+        return ALLOC_FAIL;
+
+    // update metadata (num_allocs, alloc_size)
+    size_t size = _mem_tag_size(block);
+    pool_mgr->pool.alloc_size -= size;
+    --pool_mgr->pool.num_allocs;
+
+    tag_block_pt next = _mem_tag_next(pool_mgr, block);
+    if (next != NULL && !(next->tag & MEM_TAG_ALLOCATED))
+    {
+        _mem_tag_unlink(pool_mgr, next);
+        size += _mem_tag_size(next);
     }
 
-    /*for (i; i > 0; --i)
+    if ((char *) block != pool_mgr->pool.mem)
     {
-        if (pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i-1].size ||
-            (pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i-1].size && pool_mgr->gap_ix[i].node->alloc_record.mem < pool_mgr->gap_ix[i].node->alloc_record.mem))
+        tag_block_pt prev = (tag_block_pt) ((char *) block - block->prev_size);
+        if (!(prev->tag & MEM_TAG_ALLOCATED))
         {
-            gap_t temp = pool_mgr->gap_ix[i];
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i-1];
-            pool_mgr->gap_ix[i-1] = temp;
+            _mem_tag_unlink(pool_mgr, prev);
+            size += _mem_tag_size(prev);
+            block->alloc_record.mem = NULL;
+            block = prev;
         }
-    }*/
+    }
+
+    block->tag = size;
+    block->alloc_record.mem = NULL;
+    next = _mem_tag_next(pool_mgr, block);
+    if (next != NULL)
+        next->prev_size = size;
+    _mem_tag_push(pool_mgr, block);
 
     return ALLOC_OK;
 }
 
+// one segment per block, in address order
+static void _mem_inspect_tags(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments)
+{
+    unsigned num = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(num, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    unsigned u = 0;
+    for (tag_block_pt block = (tag_block_pt) pool_mgr->pool.mem; block != NULL;
+         block = _mem_tag_next(pool_mgr, block))
+    {
+        segmentArr[u].size = _mem_tag_size(block);
+        segmentArr[u].allocated = (block->tag & MEM_TAG_ALLOCATED) ? 1 : 0;
+        ++u;
+    }
+
+    *segments = segmentArr;
+    *num_segments = num;
+}
+
+// one segment per object, in address order
+static void _mem_inspect_slab(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments)
+{
+    pool_segment_pt segmentArr = (pool_segment_pt) calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
+    assert(segmentArr);
+
+    for (unsigned u = 0; u < pool_mgr->used_nodes; ++u)
+    {
+        segmentArr[u].size = pool_mgr->slab_obj_size;
+        segmentArr[u].allocated = _mem_node_at(pool_mgr, u)->allocated;
+    }
+
+    *segments = segmentArr;
+    *num_segments = pool_mgr->used_nodes;
+}
@@ -6,25 +6,74 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy {
+    FIRST_FIT,
+    BEST_FIT,
+    SEGREGATED_FIT,
+    BUDDY,
+    SLAB,
+    TLSF,
+    NEXT_FIT,
+    ARENA,
+    STACK,
+    BOUNDARY_TAG
+} alloc_policy;
 
 typedef struct _pool {
     char *mem;
     alloc_policy policy;
     size_t total_size;
     size_t alloc_size;
+    size_t decommit_size;   // bytes of the gaps given back to the OS
     unsigned num_allocs;
     unsigned num_gaps;
 } pool_t, *pool_pt;
 
+// where the memory of a pool comes from
+typedef enum _pool_backing {
+    BACKING_MALLOC,     // malloc() (the default)
+    BACKING_MMAP,       // anonymous mmap() at a 2 MiB boundary, with
+                        //   transparent huge pages advised
+    BACKING_HUGETLB     // explicit huge pages (MAP_HUGETLB), falling back
+                        //   to BACKING_MMAP when none are available
+} pool_backing;
+
+// optional per-pool settings for mem_pool_open_opts (NULL means defaults)
+typedef struct _pool_opts {
+    const size_t *size_classes;     // SEGREGATED_FIT: ascending lower bounds
+    unsigned num_size_classes;      //   of the free-list size classes (max 64)
+    size_t slab_obj_size;           // SLAB: size of every object in the pool
+    size_t small_obj_max;           // allocations up to this size (max 256)
+                                    //   are packed into bitmap-managed runs
+    unsigned growable;              // add a region (twice the last) when full
+    pool_backing backing;           // memory of the pool and its regions
+    size_t decommit_threshold;      // merged gaps from this size on give
+                                    //   their pages back (not BACKING_MALLOC)
+} pool_opts_t, *pool_opts_pt;
+
 typedef struct _alloc {
     size_t size;
     char *mem;
 } alloc_t, *alloc_pt;
 
+// stable name of an allocation: node heap slot in the low 32 bits and
+// generation in the high 32 bits; it survives node heap growth and goes
+// stale when the allocation is deallocated
+typedef uint64_t alloc_handle_t;
+
+#define MEM_NULL_HANDLE ((alloc_handle_t) UINT64_MAX)
+
+// a point in an ARENA pool to rewind to, freeing everything after it
+typedef struct _arena_mark {
+    size_t offset;
+    size_t alloc_size;
+    unsigned num_allocs;
+} arena_mark_t;
+
 typedef struct _pool_segment {
     size_t size;
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
@@ -48,15 +97,57 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_opts(size_t size, alloc_policy policy, const pool_opts_t *opts);
+
+pool_pt
+mem_pool_open_fixed(size_t obj_size, unsigned count);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_reset(pool_pt pool);
+
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment);
+
+alloc_status
+mem_new_alloc_batch(pool_pt pool, const size_t *sizes, unsigned n, alloc_pt *out);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_del_alloc_ptr(pool_pt pool, void *mem);
+
+alloc_status
+mem_del_alloc_batch(pool_pt pool, alloc_pt *allocs, unsigned n);
+
+alloc_handle_t
+mem_new_alloc_handle(pool_pt pool, size_t size);
+
+alloc_pt
+mem_resolve_handle(pool_pt pool, alloc_handle_t handle);
+
+alloc_status
+mem_del_alloc_handle(pool_pt pool, alloc_handle_t handle);
+
+arena_mark_t
+mem_arena_mark(pool_pt pool);
+
+alloc_status
+mem_arena_rewind(pool_pt pool, arena_mark_t mark);
+
+alloc_status
+mem_stack_push_frame(pool_pt pool);
+
+alloc_status
+mem_stack_pop_frame(pool_pt pool);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
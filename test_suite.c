@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -233,6 +234,656 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_OK);
 }
 
+static void test_pool_del_alloc_ptr(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t opts = { .small_obj_max = 256 };
+    pool_pt pools[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pools[0] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    pools[1] = mem_pool_open(POOL_SIZE, BUDDY);
+    pools[2] = mem_pool_open_fixed(300, 10);
+    pools[3] = mem_pool_open_opts(POOL_SIZE, BEST_FIT, &opts);
+
+    for (int i=0; i<4; i++) {
+        pool_pt pool = pools[i];
+        assert_non_null(pool);
+
+        INFO("Deallocating by data pointer with policy %d\n", pool->policy);
+        alloc_pt alloc0 = mem_new_alloc(pool, 100);
+        alloc_pt alloc1 = mem_new_alloc(pool, 300);
+        assert_non_null(alloc0);
+        assert_non_null(alloc1);
+        char *mem0 = alloc0->mem;
+        char *mem1 = alloc1->mem;
+
+        assert_int_not_equal(mem_del_alloc_ptr(pool, mem1 + 1), ALLOC_OK);
+        assert_int_not_equal(mem_del_alloc_ptr(pool, NULL), ALLOC_OK);
+
+        assert_int_equal(mem_del_alloc_ptr(pool, mem1), ALLOC_OK);
+        assert_int_not_equal(mem_del_alloc_ptr(pool, mem1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc_ptr(pool, mem0), ALLOC_OK);
+        assert_int_not_equal(mem_del_alloc_ptr(pool, mem0), ALLOC_OK);
+        assert_int_equal(pool->num_allocs, 0);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_handles(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t opts = { .small_obj_max = 256 };
+    alloc_handle_t handles[200];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &opts);
+    assert_non_null(pool);
+
+    INFO("Allocating through handles, growing the node heap\n");
+    alloc_handle_t first = mem_new_alloc_handle(pool, 100);
+    assert_true(first != MEM_NULL_HANDLE);
+    char *mem = mem_resolve_handle(pool, first)->mem;
+
+    for (int i=0; i<200; i++) {
+        handles[i] = mem_new_alloc_handle(pool, 10);
+        assert_true(handles[i] != MEM_NULL_HANDLE);
+    }
+
+    // the node heap grew by a chunk, the handle still resolves to the same allocation
+    alloc_pt alloc = mem_resolve_handle(pool, first);
+    assert_non_null(alloc);
+    assert_ptr_equal(alloc->mem, mem);
+    assert_in_range(alloc->size, 100, 100);
+
+    INFO("Rejecting stale handles\n");
+    assert_int_equal(mem_del_alloc_handle(pool, first), ALLOC_OK);
+    assert_null(mem_resolve_handle(pool, first));
+    assert_int_not_equal(mem_del_alloc_handle(pool, first), ALLOC_OK);
+
+    // the same slot is reused by the next allocation, with a new generation
+    alloc_handle_t again = mem_new_alloc_handle(pool, 100);
+    assert_true(again != MEM_NULL_HANDLE);
+    assert_true(again != first);
+    assert_null(mem_resolve_handle(pool, first));
+    assert_null(mem_resolve_handle(pool, MEM_NULL_HANDLE));
+
+    // clean up
+    assert_int_equal(mem_del_alloc_handle(pool, again), ALLOC_OK);
+    for (int i=0; i<200; i++)
+        assert_int_equal(mem_del_alloc_handle(pool, handles[i]), ALLOC_OK);
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->num_gaps, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_backing(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t opts = { .growable = 1 };
+    const pool_backing backings[2] = { BACKING_MMAP, BACKING_HUGETLB };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (int i=0; i<2; i++) {
+        opts.backing = backings[i];
+
+        INFO("Mapping pool with backing %d\n", opts.backing);
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &opts);
+        assert_non_null(pool);
+        assert_int_equal((unsigned long) pool->mem % (2 * 1024 * 1024), 0);
+        assert_int_equal(pool->total_size, POOL_SIZE);
+
+        // the second allocation doesn't fit and maps another region
+        alloc_pt alloc0 = mem_new_alloc(pool, POOL_SIZE);
+        alloc_pt alloc1 = mem_new_alloc(pool, 100);
+        assert_non_null(alloc0);
+        assert_non_null(alloc1);
+        memset(alloc0->mem, 0xab, alloc0->size);
+        memset(alloc1->mem, 0xcd, alloc1->size);
+        assert_int_equal((unsigned long) alloc1->mem % (2 * 1024 * 1024), 0);
+
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_aligned(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t opts = { .backing = BACKING_MMAP };
+    const alloc_policy policies[5] = { FIRST_FIT, BEST_FIT, SEGREGATED_FIT, TLSF, BUDDY };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (int i=0; i<5; i++) {
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policies[i], &opts);
+        assert_non_null(pool);
+
+        // not a power of two
+        assert_null(mem_new_alloc_aligned(pool, 100, 0));
+        assert_null(mem_new_alloc_aligned(pool, 100, 48));
+
+        alloc_pt alloc0 = mem_new_alloc(pool, 3);
+        alloc_pt alloc1 = mem_new_alloc_aligned(pool, 100, 64);
+        alloc_pt alloc2 = mem_new_alloc_aligned(pool, 10, 4096);
+        assert_non_null(alloc0);
+        assert_non_null(alloc1);
+        assert_non_null(alloc2);
+        assert_int_equal((unsigned long) alloc1->mem % 64, 0);
+        assert_int_equal((unsigned long) alloc2->mem % 4096, 0);
+
+        if (policies[i] == FIRST_FIT) {
+            // the slack before each aligned allocation is a gap
+            pool_segment_t exp[6] = {
+                    {3, 1}, {61, 0}, {100, 1}, {4096 - 164, 0}, {10, 1},
+                    {POOL_SIZE - 4106, 0}
+            };
+            check_pool(pool, exp);
+        }
+
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+        assert_int_equal(pool->num_allocs, 0);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // a mapped pool is page-aligned, so an aligned block fits it exactly
+    const alloc_policy exact_policies[5] = { FIRST_FIT, BEST_FIT, SEGREGATED_FIT, NEXT_FIT, TLSF };
+    for (int i=0; i<5; i++) {
+        pool_pt pool = mem_pool_open_opts(4096, exact_policies[i], &opts);
+        assert_non_null(pool);
+        alloc_pt alloc0 = mem_new_alloc_aligned(pool, 4096, 4096);
+        assert_non_null(alloc0);
+        assert_ptr_equal(alloc0->mem, pool->mem);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // FIRST_FIT and NEXT_FIT pass over a gap that fits but not aligned
+    for (int i=0; i<4; i+=3) {
+        pool_pt pool = mem_pool_open_opts(4 * 4096, exact_policies[i], &opts);
+        assert_non_null(pool);
+        const size_t sizes[5] = { 100, 4096, 3996, 4096, 4096 };
+        alloc_pt allocs[5];
+        for (int j=0; j<5; j++) {
+            allocs[j] = mem_new_alloc(pool, sizes[j]);
+            assert_non_null(allocs[j]);
+        }
+        assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+
+        alloc_pt alloc0 = mem_new_alloc_aligned(pool, 4096, 4096);
+        assert_non_null(alloc0);
+        assert_ptr_equal(alloc0->mem, pool->mem + 2 * 4096);
+
+        pool_segment_t exp[5] = {
+                {100, 1}, {4096, 0}, {3996, 1}, {4096, 1}, {4096, 1}
+        };
+        check_pool(pool, exp);
+
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_batch(void **state) {
+    (void) state; /* unused */
+
+    const size_t sizes[4] = { 10, 20, 30, 40 };
+    const size_t bad_sizes[3] = { 10, 0, 30 };
+    alloc_pt allocs[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    // a failed batch allocates nothing
+    assert_int_equal(mem_new_alloc_batch(pool, bad_sizes, 3, allocs), ALLOC_FAIL);
+    assert_int_equal(pool->num_allocs, 0);
+
+    // the allocations are back to back, out of a single gap
+    assert_int_equal(mem_new_alloc_batch(pool, sizes, 4, allocs), ALLOC_OK);
+    for (int i=0; i<4; i++) {
+        assert_int_equal(allocs[i]->size, sizes[i]);
+        if (i > 0)
+            assert_ptr_equal(allocs[i]->mem, allocs[i-1]->mem + sizes[i-1]);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 4, 1);
+
+    pool_segment_t exp[5] = {
+            {10, 1}, {20, 1}, {30, 1}, {40, 1}, {POOL_SIZE - 100, 0}
+    };
+    check_pool(pool, exp);
+
+    // each of them is an allocation of its own
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_ptr(pool, allocs[3]->mem), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_del_batch(void **state) {
+    (void) state; /* unused */
+
+    alloc_pt allocs[6];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    for (int i=0; i<6; i++) {
+        allocs[i] = mem_new_alloc(pool, (i + 1) * 10);
+        assert_non_null(allocs[i]);
+    }
+
+    // any order, adjacent ones merge into one gap
+    alloc_pt batch0[4] = { allocs[4], allocs[1], allocs[0], allocs[2] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch0, 4), ALLOC_OK);
+
+    pool_segment_t exp0[5] = {
+            {60, 0}, {40, 1}, {50, 0}, {60, 1}, {POOL_SIZE - 210, 0}
+    };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 2, 3);
+
+    // nothing is freed when one of them can't be
+    alloc_pt batch1[2] = { allocs[3], allocs[3] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch1, 2), ALLOC_FAIL);
+    alloc_pt batch2[2] = { allocs[3], allocs[0] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch2, 2), ALLOC_FAIL);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 2, 3);
+
+    alloc_pt batch3[2] = { allocs[5], allocs[3] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch3, 2), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // every policy checks the whole batch first, small objects included
+    alloc_policy policies[3] = { FIRST_FIT, BUDDY, BOUNDARY_TAG };
+    for (int i=0; i<3; i++) {
+        pool_opts_t opts = { .small_obj_max = (policies[i] == FIRST_FIT) ? 64 : 0 };
+        pool = mem_pool_open_opts(POOL_SIZE, policies[i], &opts);
+        assert_non_null(pool);
+
+        for (int j=0; j<6; j++) {
+            allocs[j] = mem_new_alloc(pool, j * 30 + 10);
+            assert_non_null(allocs[j]);
+        }
+        unsigned num_allocs = pool->num_allocs;
+
+        alloc_pt batch4[3] = { allocs[0], allocs[4], allocs[0] };
+        assert_int_equal(mem_del_alloc_batch(pool, batch4, 3), ALLOC_FAIL);
+        assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+        alloc_pt batch5[3] = { allocs[1], allocs[5], allocs[2] };
+        assert_int_equal(mem_del_alloc_batch(pool, batch5, 3), ALLOC_FAIL);
+        assert_int_equal(pool->num_allocs, num_allocs - 1);
+
+        alloc_pt batch6[5] = { allocs[5], allocs[0], allocs[3], allocs[1], allocs[4] };
+        assert_int_equal(mem_del_alloc_batch(pool, batch6, 5), ALLOC_OK);
+        assert_int_equal(pool->num_allocs, 0);
+        assert_int_equal(pool->alloc_size, 0);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // ARENA and STACK allocations can't be freed in a batch
+    pool = mem_pool_open(POOL_SIZE, STACK);
+    assert_non_null(pool);
+    allocs[0] = mem_new_alloc(pool, 10);
+    assert_non_null(allocs[0]);
+    assert_int_equal(mem_del_alloc_batch(pool, allocs, 1), ALLOC_FAIL);
+    assert_int_equal(pool->num_allocs, 1);
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_reset(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t opts = { .small_obj_max = 64 };
+    const alloc_policy policies[6] = { FIRST_FIT, BEST_FIT, SEGREGATED_FIT, TLSF, NEXT_FIT, BUDDY };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (int i=0; i<6; i++) {
+        opts.small_obj_max = (policies[i] == BUDDY) ? 0 : 64;
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policies[i], &opts);
+        assert_non_null(pool);
+        size_t total_size = pool->total_size;
+        unsigned num_gaps = pool->num_gaps;
+
+        for (int round=0; round<3; round++) {
+            alloc_handle_t handle = mem_new_alloc_handle(pool, 100);
+            assert_int_not_equal(handle, MEM_NULL_HANDLE);
+            alloc_pt alloc = NULL;
+            for (int j=0; j<50; j++) {
+                alloc = mem_new_alloc(pool, (j % 5) * 30 + 10);
+                assert_non_null(alloc);
+            }
+            assert_int_equal(pool->num_allocs, 51);
+            char *mem = alloc->mem;
+
+            // everything is released, and the handle goes stale
+            assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+            check_metadata(pool, policies[i], total_size, 0, 0, num_gaps);
+            assert_null(mem_resolve_handle(pool, handle));
+            assert_int_equal(mem_del_alloc_ptr(pool, mem), ALLOC_FAIL);
+        }
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // SLAB pools get all their objects back
+    pool_pt pool = mem_pool_open_fixed(64, 10);
+    assert_non_null(pool);
+    for (int j=0; j<10; j++)
+        assert_non_null(mem_new_alloc(pool, 64));
+    assert_null(mem_new_alloc(pool, 64));
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_metadata(pool, SLAB, 640, 0, 0, 10);
+    assert_non_null(mem_new_alloc(pool, 64));
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_arena(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(1024, ARENA);
+    assert_non_null(pool);
+    check_metadata(pool, ARENA, 1024, 0, 0, 1);
+
+    // each allocation takes a 16-byte record and its size, rounded up
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 10);
+    assert_ptr_equal(alloc0->mem, pool->mem + 16);
+
+    arena_mark_t mark = mem_arena_mark(pool);
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    alloc_pt alloc2 = mem_new_alloc_aligned(pool, 10, 256);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc1->mem, alloc0->mem + 16 + 16);
+    assert_int_equal((unsigned long) alloc2->mem % 256, 0);
+    memset(alloc1->mem, 0xab, alloc1->size);
+
+    // allocations are only freed by a rewind, and have no handles
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc1->mem), ALLOC_FAIL);
+    assert_true(mem_new_alloc_handle(pool, 10) == MEM_NULL_HANDLE);
+    assert_null(mem_resolve_handle(pool, 0));
+    assert_int_equal(pool->num_allocs, 3);
+
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 4);
+    assert_int_equal(segs[0].size, 32);
+    assert_int_equal(segs[1].size, 128);
+    assert_int_equal(segs[0].size + segs[1].size + segs[2].size, pool->alloc_size);
+    assert_int_equal(segs[3].size, 1024 - pool->alloc_size);
+    free(segs);
+
+    // everything after the mark is gone, the arena goes on from there
+    assert_int_equal(mem_arena_rewind(pool, mark), ALLOC_OK);
+    check_metadata(pool, ARENA, 1024, 32, 1, 1);
+    alloc_pt alloc3 = mem_new_alloc(pool, 100);
+    assert_ptr_equal(alloc3, alloc1);
+
+    // and it fills up
+    assert_null(mem_new_alloc(pool, 1024));
+    assert_non_null(mem_new_alloc(pool, 1024 - 160 - 16));
+    assert_int_equal(pool->num_gaps, 0);
+    assert_null(mem_new_alloc(pool, 1));
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_arena_rewind(pool, mem_arena_mark(pool)), ALLOC_OK);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_metadata(pool, ARENA, 1024, 0, 0, 1);
+    assert_int_equal(mem_arena_rewind(pool, mark), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_stack(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(1024, STACK);
+    assert_non_null(pool);
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_FAIL);
+
+    // each record is 32 bytes, in front of the memory
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem + 32);
+    check_metadata(pool, STACK, 1024, 48, 1, 1);
+
+    assert_int_equal(mem_stack_push_frame(pool), ALLOC_OK);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    alloc_pt alloc2 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc1->mem, pool->mem + 48 + 32 + 32);
+
+    // the frame is listed with the allocation below it
+    pool_segment_t exp[4] = {
+            {48 + 32, 1}, {144, 1}, {64, 1}, {1024 - 288, 0}
+    };
+    check_pool(pool, exp);
+    check_metadata(pool, STACK, 1024, 288, 3, 1);
+
+    // only the top allocation can be freed, and there are no handles
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc1->mem), ALLOC_FAIL);
+    assert_true(mem_new_alloc_handle(pool, 10) == MEM_NULL_HANDLE);
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc2->mem), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 224, 2, 1);
+    alloc2 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc2);
+
+    // popping the frame frees everything above it, not below
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 48, 1, 1);
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_FAIL);
+    assert_ptr_equal(mem_new_alloc(pool, 100), (alloc_pt) (pool->mem + 48));
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 0, 0, 1);
+
+    // a frame at the bottom is listed with the allocation above it
+    assert_int_equal(mem_stack_push_frame(pool), ALLOC_OK);
+    assert_non_null(mem_new_alloc(pool, 10));
+    pool_segment_t exp1[2] = {
+            {32 + 48, 1}, {1024 - 80, 0}
+    };
+    check_pool(pool, exp1);
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 0, 0, 1);
+
+    // frames alone are listed as one allocated segment
+    assert_int_equal(mem_stack_push_frame(pool), ALLOC_OK);
+    assert_int_equal(mem_stack_push_frame(pool), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 64, 0, 1);
+    pool_segment_t exp2[2] = {
+            {64, 1}, {1024 - 64, 0}
+    };
+    check_pool(pool, exp2);
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_OK);
+    assert_int_equal(mem_stack_pop_frame(pool), ALLOC_OK);
+    check_metadata(pool, STACK, 1024, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_tags(void **state) {
+    (void) state; /* unused */
+
+    pool_opts_t growable = { .growable = 1 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // the pool has to hold a free block, and can't grow
+    assert_null(mem_pool_open(32, BOUNDARY_TAG));
+    assert_null(mem_pool_open_opts(1024, BOUNDARY_TAG, &growable));
+
+    // each block is a 32-byte header and the memory, in 16-byte units
+    // (the pool is rounded down to whole units)
+    pool_pt pool = mem_pool_open(1030, BOUNDARY_TAG);
+    assert_non_null(pool);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 0, 0, 1);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    alloc_pt alloc2 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc0->mem, pool->mem + 32);
+    assert_ptr_equal(alloc1->mem, pool->mem + 48 + 32);
+    assert_int_equal(alloc1->size, 100);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 256, 3, 1);
+
+    pool_segment_t exp0[4] = {
+            {48, 1}, {144, 1}, {64, 1}, {1024 - 256, 0}
+    };
+    check_pool(pool, exp0);
+
+    // only 16-byte alignment comes for free
+    assert_null(mem_new_alloc_aligned(pool, 8, 64));
+
+    // a freed block merges with the free blocks on either side
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 112, 2, 2);
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc0->mem), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc0->mem), ALLOC_FAIL);
+
+    pool_segment_t exp1[3] = {
+            {192, 0}, {64, 1}, {1024 - 256, 0}
+    };
+    check_pool(pool, exp1);
+
+    // the freed block is reused, and the rest of it split off
+    alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem + 32);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 160, 2, 2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 0, 0, 1);
+
+    assert_non_null(mem_new_alloc(pool, 500));
+    assert_null(mem_new_alloc(pool, 500));
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_metadata(pool, BOUNDARY_TAG, 1024, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_decommit(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = 1 << 20, block = 1 << 18;
+    pool_opts_t opts = { .backing = BACKING_MMAP, .decommit_threshold = 1 << 16 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // only mapped memory can be decommitted, and not BUDDY or SLAB
+    pool_opts_t malloc_opts = { .decommit_threshold = 1 << 16 };
+    assert_null(mem_pool_open_opts(pool_size, FIRST_FIT, &malloc_opts));
+    assert_null(mem_pool_open_opts(pool_size, BUDDY, &opts));
+
+    pool_pt pool = mem_pool_open_opts(pool_size, FIRST_FIT, &opts);
+    assert_non_null(pool);
+    assert_int_equal(pool->decommit_size, 0);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, block);
+    alloc_pt alloc1 = mem_new_alloc(pool, block);
+    alloc_pt alloc2 = mem_new_alloc(pool, block);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    memset(alloc1->mem, 0xab, alloc1->size);
+
+    // the freed block is a gap over the threshold, its pages go back
+    char *mem1 = alloc1->mem;
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(pool->decommit_size, block);
+    assert_int_equal(mem1[0], 0);
+    assert_int_equal(mem1[block - 1], 0);
+
+    // a small allocation recommits the first page only
+    alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    assert_true(pool->decommit_size < block);
+    assert_true(pool->decommit_size > 0);
+
+    // everything freed, the whole pool is one decommitted gap
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(pool->decommit_size, pool_size);
+
+    // a reset frees everything the same way
+    alloc0 = mem_new_alloc(pool, block);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 0xab, alloc0->size);
+    assert_int_equal(pool->decommit_size, pool_size - block);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(pool->decommit_size, pool_size);
+    assert_int_equal(pool->mem[block - 1], 0);
+
+    // and the gap stays decommitted where it is not allocated
+    alloc0 = mem_new_alloc(pool, block);
+    assert_non_null(alloc0);
+    assert_int_equal(pool->decommit_size, pool_size - block);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(pool->decommit_size, pool_size);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
 
 /*******************************************/
 /***       2. USER-FACING METADATA       ***/
@@ -2315,39 +2966,758 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
-/***                                     ***/
-/***         [non-functional]            ***/
-/***         [see NOTE below]            ***/
+/***     5. SEGREGATED_FIT SCENARIOS     ***/
 /*******************************************/
 
-void test_pool_stresstest(void **state) {
-    (void) state; /* unused */
+static const size_t SF_SIZE_CLASSES[] = { 32, 64, 128, 256 };
 
-    const unsigned num_pools = 200;
-    const unsigned num_allocations = 1000;
-    const unsigned min_alloc_size = 10;
-    const unsigned pool_size =
-            (num_allocations / 2) *
-            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
-    assert_int_equal(pool_size, 5005000);
+static int pool_sf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = SEGREGATED_FIT;
+    pool_opts_t opts = { SF_SIZE_CLASSES, 4 };
+    pool_pt pool = NULL;
 
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
 
-    pool_pt pools[num_pools];
-    alloc_pt allocations[num_pools][num_allocations];
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "SEGREGATED_FIT");
+    pool = mem_pool_open_opts(POOL_SIZE, POOL_POLICY, &opts);
+    assert_non_null(pool);
 
-    /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
-     */
+    *state = pool;
 
-    /*
+    return 0;
+}
+
+static int pool_sf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_sf_bad_classes(void **state) {
+    (void) state; /* unused */
+
+    const size_t classes[3] = { 64, 32, 128 };
+    pool_opts_t opts = { classes, 3 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    INFO("Opening pool with unordered size classes\n");
+    assert_null(mem_pool_open_opts(POOL_SIZE, SEGREGATED_FIT, &opts));
+
+    opts.num_size_classes = 0;
+    assert_null(mem_pool_open_opts(POOL_SIZE, SEGREGATED_FIT, &opts));
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_scenario20(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 20:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100, 40, 200, 50.
+     * 3. Deallocate 100 and 200. The gaps land in classes 64 and 128.
+     * 4. Allocate 60. Class 32 is empty, so it comes from the next
+     *    non-empty class, the 100 gap at the top.
+     * 5. Allocate 150. The head of its own class, the 200 gap, fits.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc2);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp1[5] =
+            {
+                    {100, 0},
+                    {40, 1},
+                    {200, 0},
+                    {50, 1},
+                    {pool->total_size - 390, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, SEGREGATED_FIT, pool->total_size, 90, 2, 3);
+
+
+    alloc_pt alloc4 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc4);
+    alloc_pt alloc5 = mem_new_alloc(pool, 150);
+    assert_non_null(alloc5);
+
+    pool_segment_t exp2[7] =
+            {
+                    {60, 1},
+                    {40, 0},
+                    {40, 1},
+                    {150, 1},
+                    {50, 0},
+                    {50, 1},
+                    {pool->total_size - 390, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, SEGREGATED_FIT, pool->total_size, 300, 4, 3);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***         6. BUDDY SCENARIOS          ***/
+/*******************************************/
+
+static int pool_bd_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BUDDY;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "BUDDY");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_bd_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario21(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 21:
+     *
+     * 1. The pool starts out as its power-of-two decomposition,
+     *    largest block first.
+     * 2. Allocate 100 and 10. Each gets the smallest block that holds it,
+     *    split off the smallest sufficient free block (512 and 64), and
+     *    counts as the whole block.
+     * 3. Deallocate both. The buddies coalesce back into 512 and 64.
+     */
+
+    pool_segment_t exp0[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 128);
+    alloc_pt alloc1 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc1->size, 16);
+
+    pool_segment_t exp1[11] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {16, 1},
+                    {16, 0},
+                    {32, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BUDDY, POOL_SIZE, 144, 2, 9);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+}
+
+/*******************************************/
+/***          7. SLAB SCENARIOS          ***/
+/*******************************************/
+
+static void test_pool_scenario22(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 22:
+     *
+     * 1. Open a fixed-size pool of 4 objects of 24 bytes.
+     *    Every object is a gap.
+     * 2. Allocate 3 objects. A request larger than the object fails.
+     * 3. Deallocate the second. The next allocation reuses it.
+     * 4. Allocate 2 more. The last one fails, the pool is full.
+     * 5. Clean up.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_fixed(24, 4);
+    assert_non_null(pool);
+
+    pool_segment_t exp0[4] =
+            {
+                    {24, 0},
+                    {24, 0},
+                    {24, 0},
+                    {24, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, SLAB, 96, 0, 0, 4);
+
+
+    alloc_pt allocs[4];
+    for (int i=0; i<3; ++i) {
+        allocs[i] = mem_new_alloc(pool, 20);
+        assert_non_null(allocs[i]);
+        assert_int_equal(allocs[i]->size, 24);
+    }
+    assert_null(mem_new_alloc(pool, 25));
+
+    pool_segment_t exp1[4] =
+            {
+                    {24, 1},
+                    {24, 1},
+                    {24, 1},
+                    {24, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, SLAB, 96, 72, 3, 1);
+
+
+    char *mem1 = allocs[1]->mem;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_not_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+
+    allocs[1] = mem_new_alloc(pool, 24);
+    assert_non_null(allocs[1]);
+    assert_true(allocs[1]->mem == mem1);
+
+    allocs[3] = mem_new_alloc(pool, 1);
+    assert_non_null(allocs[3]);
+    assert_null(mem_new_alloc(pool, 1));
+    check_metadata(pool, SLAB, 96, 96, 4, 0);
+
+
+    // clean up
+    for (int i=0; i<4; ++i)
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+
+    check_pool(pool, exp0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***          8. TLSF SCENARIOS          ***/
+/*******************************************/
+
+static int pool_tl_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = TLSF;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "TLSF");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_tl_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario23(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 23:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100, 40, 200, 50.
+     * 3. Deallocate 100 and 200.
+     * 4. Allocate 100. Its class holds the 100 gap, which is reused.
+     * 5. Allocate 190. The 200 gap is in a class above the rounded-up
+     *    request, so it is split rather than the big gap at the end.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    alloc_pt alloc4 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc4);
+    alloc_pt alloc5 = mem_new_alloc(pool, 190);
+    assert_non_null(alloc5);
+
+    pool_segment_t exp1[6] =
+            {
+                    {100, 1},
+                    {40, 1},
+                    {190, 1},
+                    {10, 0},
+                    {50, 1},
+                    {pool->total_size - 390, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, TLSF, pool->total_size, 380, 4, 2);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario27(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 27:
+     *
+     * 1. Open a TLSF pool of 1000.
+     * 2. Allocate 1000. No class above holds a gap, but the head of the
+     *    request's own class, the whole pool, fits exactly.
+     * 3. Deallocate it. Allocate 300, then 700, which fits the last gap
+     *    exactly.
+     * 4. Clean up.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(1000, TLSF);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc0);
+    check_metadata(pool, TLSF, 1000, 1000, 1, 0);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 700);
+    assert_non_null(alloc2);
+
+    pool_segment_t exp0[2] =
+            {
+                    {300, 1},
+                    {700, 1}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, TLSF, 1000, 1000, 2, 0);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    check_metadata(pool, TLSF, 1000, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***        9. NEXT_FIT SCENARIOS        ***/
+/*******************************************/
+
+static void test_pool_scenario24(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 24:
+     *
+     * 1. Open a NEXT_FIT pool of 500 and allocate 2 x 100.
+     * 2. Deallocate the first. Allocate 50. It goes after the last
+     *    allocation, not into the gap at the top.
+     * 3. Allocate 250. That fills the pool and the cursor wraps around.
+     * 4. Allocate 50. It goes into the gap at the top, where the search
+     *    resumes after wrapping, and the cursor moves to the 50 gap.
+     * 5. Deallocate that 50. The cursor's gap is merged into the freed
+     *    node, so the cursor moves back to the top.
+     * 6. Allocate 30. It goes at the top.
+     * 7. Clean up.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(500, NEXT_FIT);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc2);
+
+    pool_segment_t exp0[4] =
+            {
+                    {100, 0},
+                    {100, 1},
+                    {50, 1},
+                    {250, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 250);
+    assert_non_null(alloc3);
+    alloc_pt alloc4 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc4);
+
+    pool_segment_t exp1[5] =
+            {
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {50, 1},
+                    {250, 1}
+            };
+    check_pool(pool, exp1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    alloc_pt alloc5 = mem_new_alloc(pool, 30);
+    assert_non_null(alloc5);
+
+    pool_segment_t exp2[5] =
+            {
+                    {30, 1},
+                    {70, 0},
+                    {100, 1},
+                    {50, 1},
+                    {250, 1}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, NEXT_FIT, 500, 430, 4, 1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***      10. SMALL-OBJECT SCENARIOS     ***/
+/*******************************************/
+
+static void test_pool_scenario25(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 25:
+     *
+     * 1. Open a FIRST_FIT pool with small objects up to 256.
+     * 2. Allocate 10, 100, 256. They share a single run of 4096, and
+     *    each counts as an allocation of its granules (record included).
+     * 3. Allocate 300. That is a regular allocation. The run is listed
+     *    as its header gap, the three objects, and its free granules.
+     * 4. Deallocate everything. The empty run goes back to the pool.
+     * 5. Open a FIRST_FIT pool too small for a run, and a BEST_FIT pool
+     *    whose gaps are all too small for one. Allocate 16. It gets a
+     *    node of its own, as 100 does.
+     */
+
+    pool_opts_t opts = { .small_obj_max = 256 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &opts);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 10);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 256);
+    assert_non_null(alloc2);
+
+    assert_true((unsigned long) alloc0->mem / 4096 == (unsigned long) alloc2->mem / 4096);
+    assert_true(pool->num_allocs == 3);
+    assert_in_range(pool->alloc_size, 32 + 128 + 272, 32 + 128 + 272);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc3);
+    assert_true(pool->num_allocs == 4);
+    assert_in_range(pool->alloc_size, 432 + 300, 432 + 300);
+
+    pool_segment_pt segs = NULL;
+    unsigned size = 0;
+    mem_inspect_pool(pool, &segs, &size);
+    assert_non_null(segs);
+    // the objects in address order, wherever the run and the 300 landed
+    size_t sizes[3] = { 32, 128, 272 };
+    size_t total = 0;
+    unsigned num_small = 0, num_allocs = 0;
+    for (unsigned u = 0; u < size; u ++) {
+        total += segs[u].size;
+        if (segs[u].allocated && segs[u].size != 300)
+            assert_int_equal(segs[u].size, sizes[num_small++]);
+        num_allocs += segs[u].allocated;
+    }
+    assert_int_equal(num_small, 3);
+    assert_int_equal(num_allocs, 4);
+    assert_int_equal(total, POOL_SIZE);
+    free(segs);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_not_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_true(pool->num_allocs == 1);
+    assert_in_range(pool->alloc_size, 272, 272);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_true(pool->num_allocs == 0);
+    assert_in_range(pool->alloc_size, 0, 0);
+
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_SIZE, 0}
+            };
+    check_pool(pool, exp0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_opts(4000, FIRST_FIT, &opts);
+    assert_non_null(pool);
+    alloc0 = mem_new_alloc(pool, 16);
+    assert_non_null(alloc0);
+    alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+
+    pool_segment_t exp1[3] =
+            {
+                    {16, 1},
+                    {100, 1},
+                    {4000 - 116, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, 4000, 116, 2, 1);
+
+    assert_int_equal(mem_del_alloc_ptr(pool, alloc0->mem), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // mapped memory is page-aligned, so each gap is less than a page
+    opts.backing = BACKING_MMAP;
+    pool = mem_pool_open_opts(8 * 4096, BEST_FIT, &opts);
+    assert_non_null(pool);
+    alloc_pt fill[16];
+    for (int i=0; i<16; i++) {
+        fill[i] = mem_new_alloc(pool, (i % 2) ? 396 : 3700);
+        assert_non_null(fill[i]);
+    }
+    for (int i=0; i<16; i+=2)
+        assert_int_equal(mem_del_alloc(pool, fill[i]), ALLOC_OK);
+
+    alloc0 = mem_new_alloc(pool, 16);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem);
+    assert_int_equal(pool->num_allocs, 9);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    for (int i=1; i<16; i+=2)
+        assert_int_equal(mem_del_alloc(pool, fill[i]), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, 8 * 4096, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***     11. GROWABLE POOL SCENARIOS     ***/
+/*******************************************/
+
+static void test_pool_scenario26(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 26:
+     *
+     * 1. Open a growable FIRST_FIT pool of 1000.
+     * 2. Allocate 800, 800. The second one doesn't fit, so the pool
+     *    adds a region of 2000 (twice the first one).
+     * 3. Allocate 10000. The pool adds a region large enough for it.
+     * 4. Deallocate everything. The regions are not merged.
+     */
+
+    pool_opts_t opts = { .growable = 1 };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    assert_null(mem_pool_open_opts(POOL_SIZE, BUDDY, &opts));
+
+    pool_pt pool = mem_pool_open_opts(1000, FIRST_FIT, &opts);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 800);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 800);
+    assert_non_null(alloc1);
+
+    pool_segment_t exp0[4] =
+            {
+                    {800, 1},
+                    {200, 0},
+                    {800, 1},
+                    {1200, 0}
+            };
+    check_pool(pool, exp0);
+    assert_int_equal(pool->total_size, 3000);
+
+    alloc_pt alloc2 = mem_new_alloc(pool, 10000);
+    assert_non_null(alloc2);
+    assert_true(pool->total_size > 13000);
+    assert_int_equal(pool->num_allocs, 3);
+    assert_int_equal(pool->num_gaps, 3);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->num_gaps, 3);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***         12. STRESS TEST             ***/
+/*******************************************/
+
+void test_pool_stresstest(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_pools = 200;
+    const unsigned num_allocations = 1000;
+    const unsigned min_alloc_size = 10;
+    const unsigned pool_size =
+            (num_allocations / 2) *
+            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
+    assert_int_equal(pool_size, 5005000);
+
+
+    pool_pt pools[num_pools];
+    alloc_pt allocations[num_pools][num_allocations];
+
+    /*
+     * NOTE: The node heap grows by chunks and never moves its
+     * nodes, so the allocation records, which are a part of the
+     * nodes, keep their addresses for the lifetime of the pool.
+     */
+
+    /*
      * Testing dynamic reallocation of pool structures:
      *
      * 1. 200 pools of 5005000 each (many pools)
@@ -2407,7 +3777,7 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***        13. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
@@ -2416,6 +3786,17 @@ int run_test_suite() {
             cmocka_unit_test(test_pool_smoketest),
 
             cmocka_unit_test(test_pool_nonempty),
+            cmocka_unit_test(test_pool_del_alloc_ptr),
+            cmocka_unit_test(test_pool_handles),
+            cmocka_unit_test(test_pool_backing),
+            cmocka_unit_test(test_pool_decommit),
+            cmocka_unit_test(test_pool_aligned),
+            cmocka_unit_test(test_pool_batch),
+            cmocka_unit_test(test_pool_del_batch),
+            cmocka_unit_test(test_pool_reset),
+            cmocka_unit_test(test_pool_arena),
+            cmocka_unit_test(test_pool_stack),
+            cmocka_unit_test(test_pool_tags),
 
             cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
@@ -2442,14 +3823,28 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test(test_pool_sf_bad_classes),
+            cmocka_unit_test_setup_teardown(test_pool_scenario20, pool_sf_setup, pool_sf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario21, pool_bd_setup, pool_bd_teardown),
+
+            cmocka_unit_test(test_pool_scenario22),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario23, pool_tl_setup, pool_tl_teardown),
+            cmocka_unit_test(test_pool_scenario27),
+
+            cmocka_unit_test(test_pool_scenario24),
+
+            cmocka_unit_test(test_pool_scenario25),
+
+            cmocka_unit_test(test_pool_scenario26),
+
+            cmocka_unit_test(test_pool_stresstest),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */
-// TODO stress test: many pools, many allocations, many gaps (requires project refactoring, see NOTE in test body)
 // TODO test memory leaks: any way to do it w/o having to rewrite the source file?
 // TODO fix the final PASSED line of std::cerr output to the end of the file (?)